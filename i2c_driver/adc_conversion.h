@@ -25,9 +25,10 @@ struct bme280_calib_data {
     int8_t   dig_H6;
 };
 
-extern int32_t t_fine;
-extern struct bme280_calib_data calib;
-int32_t compensate_temp(int32_t adc_T);
-uint32_t compensate_pressure(int32_t adc_P);
-uint32_t compensate_humidity(int32_t adc_H);
+struct bme280_dev;
+
+/* Each device carries its own calibration and t_fine; call temp first */
+int32_t compensate_temp(struct bme280_dev *bme, int32_t adc_T);
+uint32_t compensate_pressure(struct bme280_dev *bme, int32_t adc_P);
+uint32_t compensate_humidity(struct bme280_dev *bme, int32_t adc_H);
 #endif
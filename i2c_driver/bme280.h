@@ -0,0 +1,107 @@
+#include <linux/types.h>
+#ifndef BME280_H
+#define BME280_H
+#include <linux/hrtimer.h>
+#include <linux/mutex.h>
+#include <linux/seqlock.h>
+#include <linux/wait.h>
+#include <linux/in.h>
+#include <linux/kfifo.h>
+#include <linux/list.h>
+#include <linux/timerqueue.h>
+#include "adc_conversion.h"
+#include "bme280_uapi.h"
+#include "bme280_bus.h"
+#include "bme280_agg.h"
+#include "bme280_deadband.h"
+#include "bme280_decim.h"
+#include "bme280_filter.h"
+#include "bme280_pipeline.h"
+//Shared between the driver's translation units
+
+struct i2c_client;
+struct regmap;
+struct task_struct;
+struct socket;
+struct bme280_cdev;
+struct bme280_stats;
+
+//64 records (1408 bytes) still fit one datagram on a 1500 byte MTU
+#define BME280_UDP_BATCH_MAX 64
+#define BME280_TX_RECORDS 256 //must be a power of two
+#define BME280_SUMMARY_RECORDS 16 //must be a power of two
+
+//Everything one probed sensor owns. Allocated with devm in my_probe(), so any
+//number of sensors (0x76/0x77, several adapters) can be driven side by side.
+struct bme280_dev {
+    struct i2c_client *client;
+    struct regmap *regmap; //all register access, config registers cached
+    struct mutex lock; //bus access + compensation state (t_fine)
+    struct bme280_calib_data calib;
+    int32_t t_fine;
+    // ---- ACQUISITION CONFIG ---- (under lock)
+    u8 osrs_t, osrs_p, osrs_h; //register codes: 0 = skipped, 1..5 = x1..x16
+    u8 filter; //IIR coefficient code, 0 = off
+    u8 t_sb; //normal mode standby code
+    bool forced; //trigger one conversion per read instead of free-running
+    bool triggered; //forced conversion started by bme280_trigger(), not read yet
+    u64 triggered_ns;
+    u64 probe_time_ns;
+
+    // ---- SAMPLING SCHEDULE ----
+    // The adapter's worker owns the absolute deadlines (epoch + n * period), so time
+    // spent reading/sending never shifts the next deadline.
+    struct bme280_bus *bus;
+    struct timerqueue_node bus_node; //expires = next deadline, under bus->lock
+    struct list_head bus_due; //worker's list of sensors served in the current pass
+    u64 prev_loop_start;
+    atomic64_t overruns;
+    unsigned int period_us;
+
+    // ---- LATEST SAMPLE ----
+    // Published by the sampler, read lock-free by sysfs (retry if the sampler was mid-write)
+    seqlock_t latest_lock;
+    struct bme280_sensor_packet latest;
+    bool latest_valid;
+
+    // ---- PIPELINE ----
+    struct bme280_pipeline __rcu *pipeline; //stages run on each sample, set from configfs
+    struct list_head pipeline_node; //bme280_pipeline_devs
+
+    // ---- FILTER ----
+    struct bme280_filter chan_filter; //set from sysfs filter/; not the sensor IIR
+
+    // ---- DECIMATION ----
+    struct bme280_decim decim; //set from sysfs decimate/
+
+    // ---- AGGREGATION ----
+    unsigned int agg_window; //samples per summary, 0 = send every sample
+    struct bme280_agg agg; //sampler only
+    struct bme280_deadband deadband; //set from sysfs deadband/
+
+    // ---- METRICS ----
+    struct bme280_stats *stats; //NULL if debugfs setup failed
+
+    // ---- SINKS ----
+    struct socket *udp_sock;
+    struct sockaddr_in udp_addr;
+    struct bme280_cdev *cdev;
+
+    // ---- NETWORK TX ----
+    // The sampler queues records, a dedicated thread batches them and sends each
+    // batch to UDP and generic netlink
+    struct task_struct *tx_thread; //NULL if it failed to start
+    wait_queue_head_t tx_wq;
+    DECLARE_KFIFO(tx_fifo, struct bme280_sensor_packet, BME280_TX_RECORDS);
+    DECLARE_KFIFO(summary_fifo, struct bme280_summary_packet, BME280_SUMMARY_RECORDS);
+    struct bme280_sensor_packet batch[BME280_UDP_BATCH_MAX]; //TX thread scratch
+    unsigned int batch_count; //send once this many are queued
+    unsigned int batch_timeout_us; //or once the oldest has waited this long, 0 = never
+    atomic64_t tx_drops; //TX queue full
+    atomic64_t tx_errors; //records in datagrams that failed to send
+};
+
+void bme280_trigger(struct bme280_dev *bme);
+void bme280_sample(struct bme280_dev *bme, u64 deadline_ns, s64 timer_late_ns);
+int bme280_read_compensated(struct bme280_dev *bme, int32_t *temp_c, uint32_t *press_q8, uint32_t *humid_q10, uint64_t *bus_ns);
+#endif
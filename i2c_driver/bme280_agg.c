@@ -0,0 +1,67 @@
+#include <linux/kernel.h>
+#include <linux/math64.h>
+#include "bme280_agg.h"
+//O(1) per sample and no sample buffer, so the window can be as long as the
+//deployment wants while the sampler still runs at full rate. Plain integer
+//arithmetic: no FPU state is touched in the kernel.
+
+#define BME280_AGG_FRAC 8 //fraction bits the standard deviation is rounded from
+
+const unsigned int bme280_channel_scale[BME280_NCHAN] = {
+    [BME280_CH_TEMP] = 1,
+    [BME280_CH_PRESS] = 256,
+    [BME280_CH_HUMID] = 1024,
+};
+
+static void bme280_agg_chan_add(struct bme280_agg_chan *c, u32 n, s32 x){
+    s64 d;
+
+    if (n == 1) {
+        c->origin = x;
+        c->min = c->max = x;
+        c->sum = 0;
+        c->sumsq = 0;
+        return;
+    }
+    d = clamp_t(s64, (s64)x - c->origin, -BME280_AGG_DEV_MAX, BME280_AGG_DEV_MAX);
+    c->sum += d;
+    c->sumsq += (u64)(d * d);
+    c->min = min(c->min, x);
+    c->max = max(c->max, x);
+}
+
+void bme280_agg_add(struct bme280_agg *agg, const struct bme280_reading *r){
+    unsigned int i;
+
+    agg->n++;
+    if (agg->n == 1)
+        agg->first_ns = r->timestamp_ns;
+    agg->last_ns = r->timestamp_ns;
+    for (i = 0; i < BME280_NCHAN; i++)
+        bme280_agg_chan_add(&agg->ch[i], agg->n, r->val[i]);
+}
+
+//n * variance = sumsq - sum^2 / n; the variance is taken in Q(2 * FRAC) so the
+//root keeps FRAC bits to round from. It is below (max - min)^2 / 4 < 2^48, so
+//the Q16 value fits.
+static void bme280_agg_chan_summary(const struct bme280_agg_chan *c, u32 n, struct bme280_channel_summary *cs){
+    u64 abs_sum = abs(c->sum);
+    u64 m2 = c->sumsq - mul_u64_u64_div_u64(abs_sum, abs_sum, n);
+    s64 mean = div64_u64(abs_sum + n / 2, n); //round half away from zero
+    u64 sd_q = int_sqrt64(mul_u64_u64_div_u64(m2, 1 << (2 * BME280_AGG_FRAC), n));
+
+    cs->min = c->min;
+    cs->max = c->max;
+    cs->mean = c->origin + (s32)(c->sum < 0 ? -mean : mean);
+    cs->stddev = (sd_q + (1 << (BME280_AGG_FRAC - 1))) >> BME280_AGG_FRAC;
+}
+
+void bme280_agg_summary(const struct bme280_agg *agg, struct bme280_summary_packet *sum){
+    sum->magic = BME280_SUMMARY_MAGIC;
+    sum->count = agg->n;
+    sum->first_ns = agg->first_ns;
+    sum->last_ns = agg->last_ns;
+    bme280_agg_chan_summary(&agg->ch[BME280_CH_TEMP], agg->n, &sum->temp);
+    bme280_agg_chan_summary(&agg->ch[BME280_CH_PRESS], agg->n, &sum->pressure);
+    bme280_agg_chan_summary(&agg->ch[BME280_CH_HUMID], agg->n, &sum->humidity);
+}
@@ -0,0 +1,51 @@
+#include <linux/types.h>
+#ifndef BME280_AGG_H
+#define BME280_AGG_H
+#include "bme280_uapi.h"
+//Windowed min/max/mean/stddev per channel, for the aggregation mode
+
+//Channels of a reading, in the order of the summary record
+enum bme280_channel {
+    BME280_CH_TEMP,  //0.01 degC
+    BME280_CH_PRESS, //Pa / 256
+    BME280_CH_HUMID, //%RH / 1024
+    BME280_NCHAN,
+};
+
+//Reading units per unit of the sensor packet (0.01 degC, Pa, %RH)
+extern const unsigned int bme280_channel_scale[BME280_NCHAN];
+
+//One compensated sample at full resolution
+struct bme280_reading {
+    u64 timestamp_ns;
+    s32 val[BME280_NCHAN];
+};
+
+//Exact sums relative to the window's first value, reduced to mean and variance
+//only when the summary is built. Deviations are clamped to BME280_AGG_DEV_MAX,
+//so a full window of squares fits in 64 bits (for pressure that is 65535 Pa away
+//from the first sample, far beyond what one window sees).
+struct bme280_agg_chan {
+    s32 origin;
+    s32 min, max;
+    s64 sum; //sum of (x - origin)
+    u64 sumsq; //sum of (x - origin)^2
+};
+
+struct bme280_agg {
+    u32 n;
+    u64 first_ns;
+    u64 last_ns;
+    struct bme280_agg_chan ch[BME280_NCHAN];
+};
+
+#define BME280_AGG_WINDOW_MAX 65536
+#define BME280_AGG_DEV_MAX ((1 << 24) - 1) //BME280_AGG_WINDOW_MAX * DEV_MAX^2 < 2^64
+
+static inline void bme280_agg_reset(struct bme280_agg *agg){
+    agg->n = 0;
+}
+
+void bme280_agg_add(struct bme280_agg *agg, const struct bme280_reading *r);
+void bme280_agg_summary(const struct bme280_agg *agg, struct bme280_summary_packet *sum);
+#endif
@@ -0,0 +1,249 @@
+#include <linux/module.h>
+#include <linux/i2c.h>
+#include <linux/cpumask.h>
+#include <linux/kthread.h>
+#include <linux/math64.h>
+#include <linux/sched.h>
+#include <linux/sched/isolation.h>
+#include <linux/slab.h>
+#include "bme280.h"
+#include "bme280_bus.h"
+//A thread per sensor meant N threads waking at unrelated instants and queueing on
+//the adapter lock. Instead every adapter gets one worker ("bme280/i2c-<nr>") that
+//owns the deadlines of all sensors on it and runs their transactions in a single
+//pass. Sensors in forced mode are all triggered before the first read, so their
+//conversions overlap instead of adding up.
+//
+//Workers of different adapters share nothing on the sample path: each sensor
+//queues into its own single-producer kfifo and has its own TX thread, and the
+//netlink group is where all of them meet. Spreading the workers over CPUs is
+//therefore enough for buses to sample in parallel.
+//
+//Lock order: bme280_buses_lock, then bus->lock, then bme280_dev.lock.
+
+static LIST_HEAD(bme280_buses);
+static DEFINE_MUTEX(bme280_buses_lock);
+
+//Hard irq context, also on PREEMPT_RT, so no wait queue (its spinlock_t sleeps on
+//RT): the worker is woken directly, which only takes raw locks.
+static enum hrtimer_restart bme280_bus_timer_fn(struct hrtimer *timer){
+    struct bme280_bus *bus = container_of(timer, struct bme280_bus, timer);
+
+    atomic64_set(&bus->timer_late_ns, ktime_get_ns() - ktime_to_ns(hrtimer_get_expires(timer)));
+    atomic_set(&bus->kick, 1);
+    wake_up_process(bus->thread);
+    return HRTIMER_NORESTART;
+}
+
+//First epoch + n * period strictly after 'after'
+static u64 bme280_bus_next_deadline(struct bme280_bus *bus, u64 after, u64 period){
+    if (after < bus->epoch_ns)
+        return bus->epoch_ns;
+    return bus->epoch_ns + (div64_u64(after - bus->epoch_ns, period) + 1) * period;
+}
+
+//Called with bus->lock held. A head that is already due (the last pass ran long)
+//gets another pass straight away instead of a timer interrupt.
+static void bme280_bus_arm(struct bme280_bus *bus){
+    struct timerqueue_node *next = timerqueue_getnext(&bus->queue);
+
+    if (!next)
+        return;
+    if (next->expires <= ktime_get_ns()) {
+        atomic_set(&bus->kick, 1);
+        wake_up_process(bus->thread);
+    } else {
+        hrtimer_start(&bus->timer, ns_to_ktime(next->expires), HRTIMER_MODE_ABS_HARD);
+    }
+}
+
+//Deadlines that already passed while the sensor waited its turn are skipped and
+//counted as overruns rather than served in a burst: the grid points in [next, skipped)
+static void bme280_bus_requeue(struct bme280_bus *bus, struct bme280_dev *bme, u64 now){
+    u64 period = (u64)READ_ONCE(bme->period_us) * NSEC_PER_USEC;
+    u64 next = bme280_bus_next_deadline(bus, bme->bus_node.expires, period);
+
+    if (next <= now) {
+        u64 skipped = bme280_bus_next_deadline(bus, now, period);
+
+        atomic64_add(div64_u64(skipped - next, period), &bme->overruns);
+        next = skipped;
+    }
+    bme->bus_node.expires = next;
+    timerqueue_add(&bus->queue, &bme->bus_node);
+}
+
+//Serves every sensor whose deadline has passed, earliest first. bus->lock is
+//dropped between passes, so probe and remove get in even when the bus is overloaded.
+static void bme280_bus_pass(struct bme280_bus *bus){
+    s64 timer_late_ns = atomic64_xchg(&bus->timer_late_ns, -1);
+    struct timerqueue_node *next;
+    struct bme280_dev *bme, *tmp;
+    LIST_HEAD(due);
+    u64 now = ktime_get_ns();
+
+    mutex_lock(&bus->lock);
+    while ((next = timerqueue_getnext(&bus->queue)) && next->expires <= now) {
+        bme = container_of(next, struct bme280_dev, bus_node);
+        timerqueue_del(&bus->queue, next);
+        list_add_tail(&bme->bus_due, &due);
+    }
+
+    list_for_each_entry(bme, &due, bus_due)
+        if (READ_ONCE(bme->forced))
+            bme280_trigger(bme);
+    list_for_each_entry(bme, &due, bus_due)
+        bme280_sample(bme, bme->bus_node.expires, timer_late_ns);
+
+    now = ktime_get_ns();
+    list_for_each_entry_safe(bme, tmp, &due, bus_due) {
+        list_del(&bme->bus_due);
+        bme280_bus_requeue(bus, bme, now);
+    }
+    bme280_bus_arm(bus);
+    mutex_unlock(&bus->lock);
+}
+
+static int bme280_bus_thread_fn(void *bus_ptr){
+    struct bme280_bus *bus = bus_ptr;
+
+    while (!kthread_should_stop()) {
+        //the state is set before the kick is tested, so a kick (or kthread_stop())
+        //landing in between turns the schedule() into a no-op
+        set_current_state(TASK_INTERRUPTIBLE);
+        if (!atomic_read(&bus->kick) && !kthread_should_stop())
+            schedule();
+        __set_current_state(TASK_RUNNING);
+        if (kthread_should_stop())
+            break;
+        atomic_set(&bus->kick, 0);
+        bme280_bus_pass(bus);
+    }
+    return 0;
+}
+
+//Online housekeeping CPU (not isolated with isolcpus/nohz_full) that the fewest
+//workers are bound to. Ties go to the highest-numbered one: CPU 0 usually carries
+//the most interrupt and softirq load. Called with bme280_buses_lock held.
+static int bme280_bus_pick_cpu(void){
+    unsigned int fewest = UINT_MAX;
+    struct bme280_bus *bus;
+    int cpu, best = -1;
+
+    for_each_cpu_and(cpu, housekeeping_cpumask(HK_TYPE_DOMAIN), cpu_online_mask) {
+        unsigned int n = 0;
+
+        list_for_each_entry(bus, &bme280_buses, node)
+            if (cpumask_weight(bus->thread->cpus_ptr) == 1 && cpumask_first(bus->thread->cpus_ptr) == cpu)
+                n++;
+        if (n <= fewest) {
+            fewest = n;
+            best = cpu;
+        }
+    }
+    return best;
+}
+
+static struct bme280_bus *bme280_bus_create(struct i2c_adapter *adapter, const struct bme280_sched *sched,
+                                            const char *cpus, bool spread){
+    struct bme280_bus *bus = kzalloc(sizeof(*bus), GFP_KERNEL);
+    int ret;
+
+    if (!bus)
+        return ERR_PTR(-ENOMEM);
+    bus->adapter = adapter;
+    bus->users = 1;
+    mutex_init(&bus->lock);
+    mutex_init(&bus->sched_lock);
+    timerqueue_init_head(&bus->queue);
+    bus->epoch_ns = ktime_get_ns();
+    atomic64_set(&bus->timer_late_ns, -1);
+    hrtimer_init(&bus->timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS_HARD);
+    bus->timer.function = bme280_bus_timer_fn;
+
+    bus->thread = kthread_create(bme280_bus_thread_fn, bus, "bme280/i2c-%d", i2c_adapter_id(adapter));
+    if (IS_ERR(bus->thread)) {
+        ret = PTR_ERR(bus->thread);
+        kfree(bus);
+        return ERR_PTR(ret);
+    }
+    //placed before it first runs; a bad setting leaves the default rather than failing probe.
+    //Deadline admission control rejects single-CPU affinity, so deadline workers are not spread.
+    if (cpus) {
+        if (bme280_sched_set_cpus(bus->thread, cpus))
+            pr_warn("i2c-%d: invalid sampler_cpus \"%s\", not pinning\n", i2c_adapter_id(adapter), cpus);
+    } else if (spread && sched->policy != SCHED_DEADLINE) {
+        int cpu = bme280_bus_pick_cpu();
+
+        if (cpu >= 0 && !set_cpus_allowed_ptr(bus->thread, cpumask_of(cpu)))
+            pr_info("i2c-%d: sampling worker on CPU %d\n", i2c_adapter_id(adapter), cpu);
+    }
+    bus->sched = *sched;
+    bus->sched.policy = SCHED_NORMAL;
+    if (sched->policy != SCHED_NORMAL) {
+        ret = bme280_sched_apply(bus->thread, sched);
+        if (ret)
+            pr_warn("i2c-%d: sampler policy rejected (%d), staying on normal\n",
+                    i2c_adapter_id(adapter), ret);
+        else
+            bus->sched.policy = sched->policy;
+    }
+    wake_up_process(bus->thread);
+    return bus;
+}
+
+//The first sensor probed on an adapter starts its worker with the given policy
+//and placement (the cpus list, or else its own CPU if spread); later ones share it.
+struct bme280_bus *bme280_bus_get(struct i2c_adapter *adapter, const struct bme280_sched *sched,
+                                  const char *cpus, bool spread){
+    struct bme280_bus *bus;
+
+    mutex_lock(&bme280_buses_lock);
+    list_for_each_entry(bus, &bme280_buses, node) {
+        if (bus->adapter == adapter) {
+            bus->users++;
+            goto out;
+        }
+    }
+    bus = bme280_bus_create(adapter, sched, cpus, spread);
+    if (!IS_ERR(bus))
+        list_add(&bus->node, &bme280_buses);
+out:
+    mutex_unlock(&bme280_buses_lock);
+    return bus;
+}
+
+//The last sensor to go stops the worker; its queue is empty by then
+void bme280_bus_put(struct bme280_bus *bus){
+    mutex_lock(&bme280_buses_lock);
+    if (--bus->users) {
+        mutex_unlock(&bme280_buses_lock);
+        return;
+    }
+    list_del(&bus->node);
+    mutex_unlock(&bme280_buses_lock);
+
+    hrtimer_cancel(&bus->timer);
+    kthread_stop(bus->thread);
+    kfree(bus);
+}
+
+//First deadline is the next bus-wide slot for the sensor's period
+void bme280_bus_add(struct bme280_bus *bus, struct bme280_dev *bme){
+    u64 period = (u64)READ_ONCE(bme->period_us) * NSEC_PER_USEC;
+
+    mutex_lock(&bus->lock);
+    timerqueue_init(&bme->bus_node);
+    bme->bus_node.expires = bme280_bus_next_deadline(bus, ktime_get_ns(), period);
+    timerqueue_add(&bus->queue, &bme->bus_node);
+    bme280_bus_arm(bus);
+    mutex_unlock(&bus->lock);
+}
+
+//A pass holds bus->lock throughout, so once this returns the worker will not
+//touch the sensor again
+void bme280_bus_del(struct bme280_bus *bus, struct bme280_dev *bme){
+    mutex_lock(&bus->lock);
+    timerqueue_del(&bus->queue, &bme->bus_node);
+    mutex_unlock(&bus->lock);
+}
@@ -0,0 +1,39 @@
+#include <linux/types.h>
+#ifndef BME280_BUS_H
+#define BME280_BUS_H
+#include <linux/hrtimer.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/timerqueue.h>
+#include "bme280_sched.h"
+//One sampling worker per I2C adapter, shared by every BME280 on that bus
+
+struct i2c_adapter;
+struct task_struct;
+struct bme280_dev;
+
+//Sensors are queued by their next absolute deadline. The hrtimer only wakes the
+//worker at the earliest one; the worker then serves every sensor that is due in
+//deadline order, back-to-back, so sensors on the same period sample together
+//instead of contending for the adapter lock from separate threads.
+struct bme280_bus {
+    struct list_head node; //bme280_buses
+    unsigned int users; //probed sensors, under bme280_buses_lock
+    struct i2c_adapter *adapter;
+    struct task_struct *thread;
+    struct hrtimer timer;
+    atomic_t kick; //timer fired or the queue head changed
+    atomic64_t timer_late_ns; //expiry to callback of the last timer, for the TIMER histogram
+    struct mutex lock; //queue; held by the worker for a whole pass
+    struct timerqueue_head queue;
+    u64 epoch_ns; //deadlines are epoch + n * period, so equal periods line up
+    struct mutex sched_lock;
+    struct bme280_sched sched; //worker's policy, set from any sensor's sysfs sched/
+};
+
+struct bme280_bus *bme280_bus_get(struct i2c_adapter *adapter, const struct bme280_sched *sched,
+                                  const char *cpus, bool spread);
+void bme280_bus_put(struct bme280_bus *bus);
+void bme280_bus_add(struct bme280_bus *bus, struct bme280_dev *bme);
+void bme280_bus_del(struct bme280_bus *bus, struct bme280_dev *bme);
+#endif
@@ -0,0 +1,336 @@
+#include <linux/module.h>
+#include <linux/fs.h>
+#include <linux/miscdevice.h>
+#include <linux/kfifo.h>
+#include <linux/mutex.h>
+#include <linux/poll.h>
+#include <linux/wait.h>
+#include <linux/device.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/refcount.h>
+#include "bme280_chardev.h"
+//In here lives /dev/bme280-<bus>-<addr>, one per sensor: a ring of binary
+//bme280_sensor_packet records filled by the sampling thread and drained by read(),
+//only while some file has the node open and has not mapped it.
+//Local consumers get every sample without going through the network stack. The
+//same node can be mmap()ed to consume the shared ring described in bme280_uapi.h
+//without any syscall per sample. The ring is only filled while mapped; a file that
+//maps it stops taking records from the kfifo, so each has its own drop count.
+
+#define BME280_FIFO_RECORDS 256 //must be a power of two
+#define BME280_RING_SLOTS   1024 //must be a power of two
+
+//Shared ring memory, mapped by userspace
+struct bme280_ring {
+    struct bme280_ring_hdr *hdr;
+    struct bme280_ring_slot *slots;
+    size_t size;
+    u64 head; //producer's copy; the one in hdr is only ever written, never trusted
+};
+
+//Per-sensor node state. Freed when the driver and every open file (which also
+//covers every mapping, since a vma pins its file) have let go of it.
+struct bme280_cdev {
+    refcount_t ref;
+    struct miscdevice misc;
+    char name[32];
+    DECLARE_KFIFO(fifo, struct bme280_sensor_packet, BME280_FIFO_RECORDS);
+    struct mutex read_lock; //kfifo is single reader; serialises concurrent readers
+    wait_queue_head_t read_wq;
+    atomic64_t drops;
+    struct mutex users_lock;
+    unsigned int readers; //open files that have not mapped the ring; fill the kfifo
+    unsigned int mappers; //files that have mapped it; fill the ring
+    unsigned int watermark; //records queued before readers are woken
+    bool registered;
+    struct bme280_ring ring;
+};
+
+struct bme280_cdev_file {
+    struct bme280_cdev *cd;
+    bool mapped;
+};
+
+static int bme280_ring_alloc(struct bme280_ring *r){
+    size_t data_offset = PAGE_ALIGN(sizeof(struct bme280_ring_hdr));
+
+    r->size = PAGE_ALIGN(data_offset + BME280_RING_SLOTS * sizeof(struct bme280_ring_slot));
+    r->hdr = vmalloc_user(r->size); //zeroed, and suitable for remap_vmalloc_range()
+    if (!r->hdr)
+        return -ENOMEM;
+    r->slots = (struct bme280_ring_slot *)((u8 *)r->hdr + data_offset);
+    r->hdr->magic = BME280_RING_MAGIC;
+    r->hdr->version = BME280_RING_VERSION;
+    r->hdr->ring_slots = BME280_RING_SLOTS;
+    r->hdr->slot_size = sizeof(struct bme280_ring_slot);
+    r->hdr->data_offset = data_offset;
+    return 0;
+}
+
+static void bme280_cdev_put(struct bme280_cdev *cd){
+    if (refcount_dec_and_test(&cd->ref)) {
+        vfree(cd->ring.hdr);
+        kfree(cd);
+    }
+}
+
+static u64 bme280_ring_used(struct bme280_ring *r){
+    return r->head - smp_load_acquire(&r->hdr->tail);
+}
+
+//Single producer. The tail is written by userspace, so a bogus value only makes
+//the ring look full; it can never make us write outside the slots.
+static void bme280_ring_push(struct bme280_ring *r, const struct bme280_sensor_packet *pkt){
+    if (bme280_ring_used(r) >= BME280_RING_SLOTS) {
+        WRITE_ONCE(r->hdr->drops, r->hdr->drops + 1);
+        return;
+    }
+    r->slots[r->head & (BME280_RING_SLOTS - 1)].pkt = *pkt;
+    r->head++;
+    //slot contents must be visible before the consumer can see the new head
+    smp_store_release(&r->hdr->head, r->head);
+}
+
+static bool bme280_cdev_ready(struct bme280_cdev *cd){
+    return kfifo_len(&cd->fifo) >= READ_ONCE(cd->watermark);
+}
+
+static bool bme280_ring_ready(struct bme280_cdev *cd){
+    return bme280_ring_used(&cd->ring) >= READ_ONCE(cd->watermark);
+}
+
+//Called from the sensor's sampling thread only, so kfifo_put() needs no lock against read()
+void bme280_cdev_push(struct bme280_cdev *cd, const struct bme280_sensor_packet *pkt){
+    if (!cd)
+        return;
+    if (READ_ONCE(cd->readers) && !kfifo_put(&cd->fifo, *pkt))
+        atomic64_inc(&cd->drops);
+    if (READ_ONCE(cd->mappers))
+        bme280_ring_push(&cd->ring, pkt);
+    if (bme280_cdev_ready(cd) || bme280_ring_ready(cd))
+        wake_up_interruptible(&cd->read_wq);
+}
+
+//misc_open() holds misc_mtx across this call and misc_deregister() takes it too,
+//so the reference is always taken before the driver can drop its own.
+static int bme280_cdev_open(struct inode *inode, struct file *file){
+    struct bme280_cdev *cd = container_of(file->private_data, struct bme280_cdev, misc);
+    struct bme280_cdev_file *f = kzalloc(sizeof(*f), GFP_KERNEL);
+
+    if (!f)
+        return -ENOMEM;
+    refcount_inc(&cd->ref);
+    f->cd = cd;
+    file->private_data = f;
+
+    //the first reader starts from the next sample, not from whatever the last
+    //one left behind. kfifo_reset_out() is the reader-side reset, safe against
+    //a sampler still finishing a put.
+    mutex_lock(&cd->users_lock);
+    if (!cd->readers) {
+        mutex_lock(&cd->read_lock);
+        kfifo_reset_out(&cd->fifo);
+        mutex_unlock(&cd->read_lock);
+    }
+    WRITE_ONCE(cd->readers, cd->readers + 1);
+    mutex_unlock(&cd->users_lock);
+    return nonseekable_open(inode, file);
+}
+
+static int bme280_cdev_release(struct inode *inode, struct file *file){
+    struct bme280_cdev_file *f = file->private_data;
+    struct bme280_cdev *cd = f->cd;
+
+    mutex_lock(&cd->users_lock);
+    if (f->mapped)
+        WRITE_ONCE(cd->mappers, cd->mappers - 1);
+    else
+        WRITE_ONCE(cd->readers, cd->readers - 1);
+    mutex_unlock(&cd->users_lock);
+    bme280_cdev_put(cd);
+    kfree(f);
+    return 0;
+}
+
+//Returns as many whole records as fit in count. Blocking readers wait for the
+//watermark so a batch is collected per syscall; O_NONBLOCK returns what is there.
+static ssize_t bme280_cdev_read(struct file *file, char __user *buf, size_t count, loff_t *ppos){
+    struct bme280_cdev *cd = ((struct bme280_cdev_file *)file->private_data)->cd;
+    unsigned int copied;
+    int ret;
+
+    if (count < sizeof(struct bme280_sensor_packet))
+        return -EINVAL;
+
+    if (mutex_lock_interruptible(&cd->read_lock))
+        return -ERESTARTSYS;
+    while (kfifo_is_empty(&cd->fifo) ||
+           (!(file->f_flags & O_NONBLOCK) && !bme280_cdev_ready(cd))) {
+        mutex_unlock(&cd->read_lock);
+        if (file->f_flags & O_NONBLOCK)
+            return -EAGAIN;
+        if (wait_event_interruptible(cd->read_wq, bme280_cdev_ready(cd) || !READ_ONCE(cd->registered)))
+            return -ERESTARTSYS;
+        if (!READ_ONCE(cd->registered))
+            return -ENODEV;
+        if (mutex_lock_interruptible(&cd->read_lock))
+            return -ERESTARTSYS;
+    }
+    ret = kfifo_to_user(&cd->fifo, buf, count, &copied);
+    mutex_unlock(&cd->read_lock);
+
+    return ret ? ret : copied;
+}
+
+//A file that has mapped the ring is woken on ring occupancy instead of the kfifo
+static __poll_t bme280_cdev_poll(struct file *file, poll_table *wait){
+    struct bme280_cdev_file *f = file->private_data;
+    struct bme280_cdev *cd = f->cd;
+    bool ready;
+
+    poll_wait(file, &cd->read_wq, wait);
+    if (!READ_ONCE(cd->registered))
+        return EPOLLHUP;
+    ready = READ_ONCE(f->mapped) ? bme280_ring_ready(cd) : bme280_cdev_ready(cd);
+    return ready ? EPOLLIN | EPOLLRDNORM : 0;
+}
+
+static int bme280_cdev_mmap(struct file *file, struct vm_area_struct *vma){
+    struct bme280_cdev_file *f = file->private_data;
+    struct bme280_cdev *cd = f->cd;
+    struct bme280_ring *r = &cd->ring;
+    unsigned long len = vma->vm_end - vma->vm_start;
+    int ret;
+
+    if (vma->vm_pgoff != 0 || len > r->size)
+        return -EINVAL;
+    ret = remap_vmalloc_range(vma, r->hdr, 0);
+    if (ret)
+        return ret;
+    vm_flags_set(vma, VM_DONTEXPAND | VM_DONTDUMP);
+
+    //From here on the file consumes through the ring, not the kfifo. The first
+    //mapping starts at the current head, so it does not see slots left over
+    //from an earlier consumer.
+    mutex_lock(&cd->users_lock);
+    if (!f->mapped) {
+        if (!cd->mappers)
+            smp_store_release(&r->hdr->tail, smp_load_acquire(&r->hdr->head));
+        WRITE_ONCE(cd->readers, cd->readers - 1);
+        WRITE_ONCE(cd->mappers, cd->mappers + 1);
+        WRITE_ONCE(f->mapped, true);
+    }
+    mutex_unlock(&cd->users_lock);
+    return 0;
+}
+
+static const struct file_operations bme280_cdev_fops = {
+    .owner = THIS_MODULE,
+    .open = bme280_cdev_open,
+    .release = bme280_cdev_release,
+    .read = bme280_cdev_read,
+    .poll = bme280_cdev_poll,
+    .mmap = bme280_cdev_mmap,
+    .llseek = noop_llseek,
+};
+
+//misc_register() stores the miscdevice as the class device's drvdata
+static struct bme280_cdev *to_bme280_cdev(struct device *dev){
+    struct miscdevice *misc = dev_get_drvdata(dev);
+
+    return container_of(misc, struct bme280_cdev, misc);
+}
+
+static ssize_t watermark_show(struct device *dev,
+                              struct device_attribute *attr,
+                              char *buf)
+{
+    return sprintf(buf, "%u\n", READ_ONCE(to_bme280_cdev(dev)->watermark));
+}
+
+static ssize_t watermark_store(struct device *dev,
+                               struct device_attribute *attr,
+                               const char *buf, size_t count)
+{
+    struct bme280_cdev *cd = to_bme280_cdev(dev);
+    unsigned int val;
+    int ret = kstrtouint(buf, 0, &val);
+
+    if (ret)
+        return ret;
+    if (val < 1 || val > BME280_FIFO_RECORDS)
+        return -EINVAL;
+    WRITE_ONCE(cd->watermark, val);
+    //a lower watermark may already be satisfied
+    wake_up_interruptible(&cd->read_wq);
+    return count;
+}
+
+static DEVICE_ATTR_RW(watermark);
+
+//Records lost because a reader fell a full kfifo behind
+static ssize_t drops_show(struct device *dev,
+                          struct device_attribute *attr,
+                          char *buf)
+{
+    return sprintf(buf, "%lld\n", atomic64_read(&to_bme280_cdev(dev)->drops));
+}
+
+static DEVICE_ATTR_RO(drops);
+
+static struct attribute *bme280_cdev_attrs[] = {
+    &dev_attr_watermark.attr,
+    &dev_attr_drops.attr,
+    NULL,
+};
+ATTRIBUTE_GROUPS(bme280_cdev);
+
+struct bme280_cdev *bme280_cdev_register(struct device *parent, const char *id){
+    struct bme280_cdev *cd = kzalloc(sizeof(*cd), GFP_KERNEL);
+    int ret;
+
+    if (!cd)
+        return ERR_PTR(-ENOMEM);
+    ret = bme280_ring_alloc(&cd->ring);
+    if (ret) {
+        kfree(cd);
+        return ERR_PTR(ret);
+    }
+    refcount_set(&cd->ref, 1);
+    INIT_KFIFO(cd->fifo);
+    mutex_init(&cd->read_lock);
+    mutex_init(&cd->users_lock);
+    init_waitqueue_head(&cd->read_wq);
+    atomic64_set(&cd->drops, 0);
+    cd->watermark = 1;
+    snprintf(cd->name, sizeof(cd->name), "bme280-%s", id);
+
+    cd->misc.minor = MISC_DYNAMIC_MINOR;
+    cd->misc.name = cd->name;
+    cd->misc.fops = &bme280_cdev_fops;
+    cd->misc.groups = bme280_cdev_groups;
+    //read() consumers only need read access. The mmap consumer must open O_RDWR
+    //to move the ring tail; that is granted to a group by 99-bme280.rules.
+    cd->misc.mode = 0444;
+    cd->misc.parent = parent;
+    cd->registered = true;
+    ret = misc_register(&cd->misc);
+    if (ret) {
+        bme280_cdev_put(cd);
+        return ERR_PTR(ret);
+    }
+    return cd;
+}
+
+//The sampling thread must already be stopped
+void bme280_cdev_unregister(struct bme280_cdev *cd){
+    if (!cd)
+        return;
+    misc_deregister(&cd->misc);
+    WRITE_ONCE(cd->registered, false);
+    wake_up_interruptible(&cd->read_wq);
+    //open files and existing mappings keep their own reference
+    bme280_cdev_put(cd);
+}
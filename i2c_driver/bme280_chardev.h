@@ -0,0 +1,12 @@
+#include <linux/types.h>
+#ifndef BME280_CHARDEV_H
+#define BME280_CHARDEV_H
+#include "bme280_uapi.h"
+
+struct device;
+struct bme280_cdev;
+
+struct bme280_cdev *bme280_cdev_register(struct device *parent, const char *id);
+void bme280_cdev_unregister(struct bme280_cdev *cd);
+void bme280_cdev_push(struct bme280_cdev *cd, const struct bme280_sensor_packet *pkt);
+#endif
@@ -0,0 +1,109 @@
+#include <linux/module.h>
+#include <linux/device.h>
+#include <linux/math64.h>
+#include "bme280.h"
+#include "bme280_deadband.h"
+//Slowly changing indoor sensors repeat the same values for minutes; only changes
+//(and a periodic heartbeat, so receivers can tell a quiet sensor from a dead one)
+//are worth a datagram. Exposed per sensor as sysfs deadband/{temp_c,pressure_pa,
+//humidity_percent}, deadband/<channel>_rel_ppm, deadband/heartbeat_ms and the
+//deadband/suppressed counter.
+//
+//A channel's band is the larger of its absolute and relative threshold; a channel
+//with both at 0 never triggers a send. With every threshold at 0 the deadband is
+//off and every sample is sent.
+
+//Sampler only. True if the reading should be sent.
+bool bme280_deadband_pass(struct bme280_deadband *db, const struct bme280_reading *r){
+    unsigned int heartbeat_ms = READ_ONCE(db->heartbeat_ms);
+    bool enabled = false;
+    bool send = !db->primed;
+    unsigned int i;
+
+    for (i = 0; i < BME280_NCHAN; i++) {
+        u64 abs_band = (u64)READ_ONCE(db->abs[i]) * bme280_channel_scale[i];
+        unsigned int rel_ppm = READ_ONCE(db->rel_ppm[i]);
+        u64 rel_band, band;
+
+        if (!abs_band && !rel_ppm)
+            continue;
+        enabled = true;
+        if (send)
+            continue;
+        rel_band = div_u64((u64)abs((s64)db->last.val[i]) * rel_ppm, 1000000);
+        band = max(abs_band, rel_band);
+        if ((u64)abs((s64)r->val[i] - db->last.val[i]) > band)
+            send = true;
+    }
+    if (!enabled) {
+        db->primed = false;
+        return true;
+    }
+    if (heartbeat_ms && r->timestamp_ns - db->last.timestamp_ns >= (u64)heartbeat_ms * NSEC_PER_MSEC)
+        send = true;
+    if (!send) {
+        atomic64_inc(&db->suppressed);
+        return false;
+    }
+    db->last = *r;
+    db->primed = true;
+    return true;
+}
+
+#define BME280_DEADBAND_ATTR(_name, _field)                                       \
+static ssize_t _name##_show(struct device *dev,                                  \
+                            struct device_attribute *attr, char *buf)           \
+{                                                                                \
+    struct bme280_dev *bme = dev_get_drvdata(dev);                               \
+    return sprintf(buf, "%u\n", READ_ONCE(bme->deadband._field));                \
+}                                                                                \
+static ssize_t _name##_store(struct device *dev,                                 \
+                             struct device_attribute *attr,                     \
+                             const char *buf, size_t count)                     \
+{                                                                                \
+    struct bme280_dev *bme = dev_get_drvdata(dev);                               \
+    unsigned int val;                                                            \
+    int ret = kstrtouint(buf, 0, &val);                                          \
+    if (ret)                                                                     \
+        return ret;                                                              \
+    WRITE_ONCE(bme->deadband._field, val);                                       \
+    return count;                                                                \
+}                                                                                \
+static DEVICE_ATTR_RW(_name)
+
+BME280_DEADBAND_ATTR(temp_c, abs[BME280_CH_TEMP]);
+BME280_DEADBAND_ATTR(temp_rel_ppm, rel_ppm[BME280_CH_TEMP]);
+BME280_DEADBAND_ATTR(pressure_pa, abs[BME280_CH_PRESS]);
+BME280_DEADBAND_ATTR(pressure_rel_ppm, rel_ppm[BME280_CH_PRESS]);
+BME280_DEADBAND_ATTR(humidity_percent, abs[BME280_CH_HUMID]);
+BME280_DEADBAND_ATTR(humidity_rel_ppm, rel_ppm[BME280_CH_HUMID]);
+BME280_DEADBAND_ATTR(heartbeat_ms, heartbeat_ms);
+
+//Samples held back because no channel left its band
+static ssize_t suppressed_show(struct device *dev,
+                               struct device_attribute *attr,
+                               char *buf)
+{
+    struct bme280_dev *bme = dev_get_drvdata(dev);
+
+    return sprintf(buf, "%lld\n", atomic64_read(&bme->deadband.suppressed));
+}
+
+static DEVICE_ATTR_RO(suppressed);
+
+static struct attribute *bme280_deadband_attrs[] = {
+    &dev_attr_temp_c.attr,
+    &dev_attr_temp_rel_ppm.attr,
+    &dev_attr_pressure_pa.attr,
+    &dev_attr_pressure_rel_ppm.attr,
+    &dev_attr_humidity_percent.attr,
+    &dev_attr_humidity_rel_ppm.attr,
+    &dev_attr_heartbeat_ms.attr,
+    &dev_attr_suppressed.attr,
+    NULL,
+};
+
+const struct attribute_group bme280_deadband_group = {
+    .name = "deadband",
+    .attrs = bme280_deadband_attrs,
+};
@@ -0,0 +1,26 @@
+#include <linux/types.h>
+#ifndef BME280_DEADBAND_H
+#define BME280_DEADBAND_H
+#include <linux/atomic.h>
+#include "bme280_agg.h"
+//Change-triggered reporting: a sample goes out only when a channel moved past its
+//deadband since the last one sent, or the heartbeat interval ran out
+
+struct attribute_group;
+
+//Thresholds are set from sysfs and read by the sampler without a lock; the rest
+//is sampler only
+struct bme280_deadband {
+    unsigned int abs[BME280_NCHAN]; //0.01 degC, Pa, %RH (units of the sensor packet)
+    unsigned int rel_ppm[BME280_NCHAN]; //of the last sent value
+    unsigned int heartbeat_ms; //0 = none
+    bool primed; //last holds a sent reading
+    struct bme280_reading last;
+    atomic64_t suppressed;
+};
+
+bool bme280_deadband_pass(struct bme280_deadband *db, const struct bme280_reading *r);
+
+//sysfs deadband/ directory of the sensor device
+extern const struct attribute_group bme280_deadband_group;
+#endif
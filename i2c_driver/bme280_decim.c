@@ -0,0 +1,367 @@
+#include <linux/module.h>
+#include <linux/debugfs.h>
+#include <linux/device.h>
+#include <linux/math64.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include "bme280.h"
+#include "bme280_decim.h"
+//At 1x oversampling the sensor converts at ~150 Hz, far above the rate the
+//network needs. Sampling fast and low-passing in the kernel trades the extra
+//I2C reads for lower noise at the same number of datagrams: every channel goes
+//through a CIC (order 1..4, unity gain after dividing by factor^order) or a Q15
+//FIR, and only one sample in 'factor' leaves the sampler, carrying the timestamp
+//of the last input. Nothing is sent until the filter has seen enough samples to
+//fill its history, so a config change costs one filter length of output.
+//
+//sysfs decimate/{filter,factor,cic_order,taps,output_period_us}; the sample rate
+//is still sample_period_us. debugfs bme280/<device>/decimate_bench times the
+//current config on synthetic input.
+
+#define BME280_DECIM_BENCH_OUTPUTS 10000
+
+//Clears the filter state and derives the CIC gain, with dec->lock held
+static void bme280_decim_reset(struct bme280_decim *dec){
+    unsigned int k;
+
+    dec->phase = 0;
+    dec->head = 0;
+    dec->fill = 0;
+    dec->cic_gain = 1;
+    for (k = 0; k < dec->cfg.order; k++)
+        dec->cic_gain *= dec->cfg.factor;
+    memset(dec->ch, 0, sizeof(dec->ch));
+}
+
+void bme280_decim_init(struct bme280_decim *dec, unsigned int factor){
+    mutex_init(&dec->lock);
+    dec->cfg.filter = BME280_DECIM_CIC;
+    dec->cfg.factor = clamp(factor, 1U, (unsigned int)BME280_DECIM_FACTOR_MAX);
+    dec->cfg.order = 3;
+    dec->cfg.ntaps = 0;
+    bme280_decim_reset(dec);
+}
+
+static s32 bme280_decim_div_round(s64 y, u64 d){
+    if (y >= 0)
+        return div64_u64(y + d / 2, d);
+    return -(s64)div64_u64(-y + d / 2, d);
+}
+
+//One input sample. The integrators (CIC) or the history (FIR) take every sample;
+//the combs or the dot product only run on output samples. Returns true when r
+//was replaced by an output.
+static bool bme280_decim_run(struct bme280_decim *dec, struct bme280_reading *r){
+    const struct bme280_decim_cfg *cfg = &dec->cfg;
+    unsigned int warmup = cfg->filter == BME280_DECIM_CIC ? cfg->order * cfg->factor : cfg->ntaps;
+    unsigned int i, k;
+    bool out;
+
+    if (dec->fill < UINT_MAX)
+        dec->fill++;
+    out = ++dec->phase >= cfg->factor;
+    if (out)
+        dec->phase = 0;
+
+    for (i = 0; i < BME280_NCHAN; i++) {
+        struct bme280_decim_chan *c = &dec->ch[i];
+
+        if (cfg->filter == BME280_DECIM_CIC) {
+            u64 y;
+
+            c->integ[0] += (s64)r->val[i];
+            for (k = 1; k < cfg->order; k++)
+                c->integ[k] += c->integ[k - 1];
+            if (!out)
+                continue;
+            y = c->integ[cfg->order - 1];
+            for (k = 0; k < cfg->order; k++) {
+                u64 t = y;
+
+                y -= c->comb[k];
+                c->comb[k] = t;
+            }
+            r->val[i] = bme280_decim_div_round((s64)y, dec->cic_gain);
+        } else {
+            s64 acc = 0;
+
+            c->hist[dec->head] = r->val[i];
+            if (!out)
+                continue;
+            for (k = 0; k < cfg->ntaps; k++)
+                acc += (s64)cfg->taps[k] * c->hist[(dec->head - k) & (BME280_DECIM_TAPS_MAX - 1)];
+            r->val[i] = (acc + (1 << (BME280_DECIM_TAP_FRAC - 1))) >> BME280_DECIM_TAP_FRAC;
+        }
+    }
+    dec->head = (dec->head + 1) & (BME280_DECIM_TAPS_MAX - 1);
+    return out && dec->fill >= warmup;
+}
+
+//Sampler side. True if r (possibly replaced by a filter output) should go on to
+//the consumers.
+bool bme280_decim_step(struct bme280_decim *dec, struct bme280_reading *r){
+    bool out;
+
+    if (READ_ONCE(dec->cfg.factor) <= 1)
+        return true;
+    mutex_lock(&dec->lock);
+    out = dec->cfg.factor <= 1 || bme280_decim_run(dec, r);
+    mutex_unlock(&dec->lock);
+    return out;
+}
+
+// ---- BENCHMARK ----
+
+//Noise around typical indoor values, so the filter does real arithmetic
+static void bme280_decim_bench_input(struct bme280_reading *r, u32 *seed){
+    *seed = *seed * 1664525 + 1013904223;
+    r->val[BME280_CH_TEMP] = 2150 + (*seed >> 28);
+    r->val[BME280_CH_PRESS] = (101325 << 8) + ((*seed >> 16) & 0xfff);
+    r->val[BME280_CH_HUMID] = 45 * 1024 + ((*seed >> 8) & 0x3ff);
+}
+
+//Runs a private copy of the sensor's current config, so the sampler is not
+//disturbed. The time includes generating the input (an LCG step per sample).
+static int bme280_decim_bench_show(struct seq_file *s, void *unused){
+    struct bme280_decim *dec = s->private;
+    struct bme280_decim *bench = kzalloc(sizeof(*bench), GFP_KERNEL);
+    struct bme280_reading r = {};
+    unsigned int outputs = 0;
+    u64 inputs = 0, start, ns;
+    u32 seed = 1;
+
+    if (!bench)
+        return -ENOMEM;
+    mutex_lock(&dec->lock);
+    bench->cfg = dec->cfg;
+    mutex_unlock(&dec->lock);
+    bme280_decim_reset(bench);
+
+    //fill the history and warm the caches first
+    do {
+        bme280_decim_bench_input(&r, &seed);
+    } while (!bme280_decim_run(bench, &r));
+
+    start = ktime_get_ns();
+    while (outputs < BME280_DECIM_BENCH_OUTPUTS) {
+        bme280_decim_bench_input(&r, &seed);
+        inputs++;
+        if (bme280_decim_run(bench, &r))
+            outputs++;
+    }
+    ns = ktime_get_ns() - start;
+
+    if (bench->cfg.filter == BME280_DECIM_CIC)
+        seq_printf(s, "filter cic\norder %u\n", bench->cfg.order);
+    else
+        seq_printf(s, "filter fir\ntaps %u\n", bench->cfg.ntaps);
+    seq_printf(s, "factor %u\n", bench->cfg.factor);
+    seq_printf(s, "outputs %u\n", outputs);
+    seq_printf(s, "inputs %llu\n", inputs);
+    seq_printf(s, "total_ns %llu\n", ns);
+    seq_printf(s, "ns_per_output %llu\n", div_u64(ns, outputs));
+    seq_printf(s, "ns_per_input %llu\n", div64_u64(ns, inputs));
+    kfree(bench);
+    return 0;
+}
+
+static int bme280_decim_bench_open(struct inode *inode, struct file *file){
+    return single_open(file, bme280_decim_bench_show, inode->i_private);
+}
+
+static const struct file_operations bme280_decim_bench_fops = {
+    .owner = THIS_MODULE,
+    .open = bme280_decim_bench_open,
+    .read = seq_read,
+    .llseek = seq_lseek,
+    .release = single_release,
+};
+
+//Goes away with the rest of the sensor's debugfs directory
+void bme280_decim_debugfs(struct bme280_decim *dec, struct dentry *dir){
+    debugfs_create_file("decimate_bench", 0400, dir, dec, &bme280_decim_bench_fops);
+}
+
+// ---- SYSFS ----
+
+static ssize_t filter_show(struct device *dev,
+                           struct device_attribute *attr,
+                           char *buf)
+{
+    struct bme280_dev *bme = dev_get_drvdata(dev);
+
+    return sprintf(buf, "%s\n", READ_ONCE(bme->decim.cfg.filter) == BME280_DECIM_CIC ? "cic" : "fir");
+}
+
+//"cic" or "fir"; fir needs taps first
+static ssize_t filter_store(struct device *dev,
+                            struct device_attribute *attr,
+                            const char *buf, size_t count)
+{
+    struct bme280_dev *bme = dev_get_drvdata(dev);
+    struct bme280_decim *dec = &bme->decim;
+    enum bme280_decim_filter filter;
+    int ret = 0;
+
+    if (sysfs_streq(buf, "cic"))
+        filter = BME280_DECIM_CIC;
+    else if (sysfs_streq(buf, "fir"))
+        filter = BME280_DECIM_FIR;
+    else
+        return -EINVAL;
+
+    mutex_lock(&dec->lock);
+    if (filter == BME280_DECIM_FIR && !dec->cfg.ntaps) {
+        ret = -EINVAL;
+    } else {
+        WRITE_ONCE(dec->cfg.filter, filter);
+        bme280_decim_reset(dec);
+    }
+    mutex_unlock(&dec->lock);
+    return ret ? ret : count;
+}
+
+static DEVICE_ATTR_RW(filter);
+
+static ssize_t factor_show(struct device *dev,
+                           struct device_attribute *attr,
+                           char *buf)
+{
+    struct bme280_dev *bme = dev_get_drvdata(dev);
+
+    return sprintf(buf, "%u\n", READ_ONCE(bme->decim.cfg.factor));
+}
+
+//Samples per output, 1 passes every sample through unfiltered
+static ssize_t factor_store(struct device *dev,
+                            struct device_attribute *attr,
+                            const char *buf, size_t count)
+{
+    struct bme280_dev *bme = dev_get_drvdata(dev);
+    struct bme280_decim *dec = &bme->decim;
+    unsigned int val;
+    int ret = kstrtouint(buf, 0, &val);
+
+    if (ret)
+        return ret;
+    if (val < 1 || val > BME280_DECIM_FACTOR_MAX)
+        return -EINVAL;
+    mutex_lock(&dec->lock);
+    WRITE_ONCE(dec->cfg.factor, val);
+    bme280_decim_reset(dec);
+    mutex_unlock(&dec->lock);
+    return count;
+}
+
+static DEVICE_ATTR_RW(factor);
+
+static ssize_t cic_order_show(struct device *dev,
+                              struct device_attribute *attr,
+                              char *buf)
+{
+    struct bme280_dev *bme = dev_get_drvdata(dev);
+
+    return sprintf(buf, "%u\n", READ_ONCE(bme->decim.cfg.order));
+}
+
+static ssize_t cic_order_store(struct device *dev,
+                               struct device_attribute *attr,
+                               const char *buf, size_t count)
+{
+    struct bme280_dev *bme = dev_get_drvdata(dev);
+    struct bme280_decim *dec = &bme->decim;
+    unsigned int val;
+    int ret = kstrtouint(buf, 0, &val);
+
+    if (ret)
+        return ret;
+    if (val < 1 || val > BME280_DECIM_CIC_ORDER_MAX)
+        return -EINVAL;
+    mutex_lock(&dec->lock);
+    WRITE_ONCE(dec->cfg.order, val);
+    bme280_decim_reset(dec);
+    mutex_unlock(&dec->lock);
+    return count;
+}
+
+static DEVICE_ATTR_RW(cic_order);
+
+static ssize_t taps_show(struct device *dev,
+                         struct device_attribute *attr,
+                         char *buf)
+{
+    struct bme280_dev *bme = dev_get_drvdata(dev);
+    struct bme280_decim *dec = &bme->decim;
+    ssize_t len = 0;
+    unsigned int k;
+
+    mutex_lock(&dec->lock);
+    for (k = 0; k < dec->cfg.ntaps; k++)
+        len += sprintf(buf + len, "%s%d", k ? " " : "", dec->cfg.taps[k]);
+    mutex_unlock(&dec->lock);
+    len += sprintf(buf + len, "\n");
+    return len;
+}
+
+//Whitespace-separated Q15 coefficients, newest sample first, e.g. from a
+//windowed-sinc design scaled so they sum to 32768
+static ssize_t taps_store(struct device *dev,
+                          struct device_attribute *attr,
+                          const char *buf, size_t count)
+{
+    struct bme280_dev *bme = dev_get_drvdata(dev);
+    struct bme280_decim *dec = &bme->decim;
+    s16 taps[BME280_DECIM_TAPS_MAX];
+    unsigned int n = 0;
+    int val, len;
+
+    for (;;) {
+        buf = skip_spaces(buf);
+        if (!*buf)
+            break;
+        if (n == BME280_DECIM_TAPS_MAX || sscanf(buf, "%d%n", &val, &len) != 1)
+            return -EINVAL;
+        if (val < S16_MIN || val > S16_MAX)
+            return -ERANGE;
+        taps[n++] = val;
+        buf += len;
+    }
+    if (!n)
+        return -EINVAL;
+
+    mutex_lock(&dec->lock);
+    memcpy(dec->cfg.taps, taps, n * sizeof(taps[0]));
+    dec->cfg.ntaps = n;
+    bme280_decim_reset(dec);
+    mutex_unlock(&dec->lock);
+    return count;
+}
+
+static DEVICE_ATTR_RW(taps);
+
+//Interval between the samples that leave the sampler
+static ssize_t output_period_us_show(struct device *dev,
+                                     struct device_attribute *attr,
+                                     char *buf)
+{
+    struct bme280_dev *bme = dev_get_drvdata(dev);
+
+    return sprintf(buf, "%llu\n", (u64)READ_ONCE(bme->period_us) * READ_ONCE(bme->decim.cfg.factor));
+}
+
+static DEVICE_ATTR_RO(output_period_us);
+
+static struct attribute *bme280_decim_attrs[] = {
+    &dev_attr_filter.attr,
+    &dev_attr_factor.attr,
+    &dev_attr_cic_order.attr,
+    &dev_attr_taps.attr,
+    &dev_attr_output_period_us.attr,
+    NULL,
+};
+
+const struct attribute_group bme280_decim_group = {
+    .name = "decimate",
+    .attrs = bme280_decim_attrs,
+};
@@ -0,0 +1,54 @@
+#include <linux/types.h>
+#ifndef BME280_DECIM_H
+#define BME280_DECIM_H
+#include <linux/mutex.h>
+#include "bme280_agg.h"
+//Oversample-and-decimate: CIC or FIR low-pass over every channel, one output per
+//'factor' samples
+
+struct attribute_group;
+struct dentry;
+
+#define BME280_DECIM_FACTOR_MAX 256
+#define BME280_DECIM_CIC_ORDER_MAX 4
+#define BME280_DECIM_TAPS_MAX 64 //power of two, the FIR history is a ring
+#define BME280_DECIM_TAP_FRAC 15 //taps are Q15, unity DC gain when they sum to 32768
+
+enum bme280_decim_filter {
+    BME280_DECIM_CIC,
+    BME280_DECIM_FIR,
+};
+
+struct bme280_decim_cfg {
+    enum bme280_decim_filter filter;
+    unsigned int factor; //1 = off
+    unsigned int order; //CIC stages
+    unsigned int ntaps;
+    s16 taps[BME280_DECIM_TAPS_MAX];
+};
+
+//CIC registers wrap modulo 2^64; the comb differences are exact as long as
+//input bits + order * log2(factor) fit, which 26 + 4 * 8 does
+struct bme280_decim_chan {
+    u64 integ[BME280_DECIM_CIC_ORDER_MAX];
+    u64 comb[BME280_DECIM_CIC_ORDER_MAX];
+    s32 hist[BME280_DECIM_TAPS_MAX];
+};
+
+struct bme280_decim {
+    struct mutex lock; //cfg and filter state; a sysfs change resets the state mid-stream
+    struct bme280_decim_cfg cfg;
+    unsigned int phase; //samples since the last output
+    unsigned int head; //next FIR history slot
+    unsigned int fill; //samples since the last reset, saturating
+    u64 cic_gain; //factor ^ order
+    struct bme280_decim_chan ch[BME280_NCHAN];
+};
+
+void bme280_decim_init(struct bme280_decim *dec, unsigned int factor);
+bool bme280_decim_step(struct bme280_decim *dec, struct bme280_reading *r);
+void bme280_decim_debugfs(struct bme280_decim *dec, struct dentry *dir);
+
+//sysfs decimate/ directory of the sensor device
+extern const struct attribute_group bme280_decim_group;
+#endif
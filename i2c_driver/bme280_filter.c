@@ -0,0 +1,283 @@
+#include <linux/module.h>
+#include <linux/device.h>
+#include <linux/string.h>
+#include "bme280.h"
+#include "bme280_filter.h"
+//Runs on every sample straight after the read, ahead of decimation, so it must
+//stay cheap: integer arithmetic on state embedded in the device, no allocation.
+//
+//Per channel (sysfs filter/{temp_c,pressure_pa,humidity_percent}):
+//  "none", "ewma <alpha>" with alpha in 1/65536 (6554 ~ 0.1), or "median <n>"
+//  over the last n samples (odd, up to 9), kept as a ring plus a sorted copy
+//  so each sample is one removal and one insertion.
+//Spike rejection (filter/<channel>_spike, in sensor packet units, 0 = off)
+//replaces an input further than that from the last accepted one by the last
+//accepted one, up to filter/spike_hold times in a row; after that the jump is
+//taken as real. filter/rejected counts the replaced inputs.
+
+static void bme280_filter_chan_reset(struct bme280_filter_chan *c){
+    c->primed = false;
+    c->rejects = 0;
+    c->count = 0;
+    c->head = 0;
+}
+
+//With f->lock held, after any config change
+static void bme280_filter_update_active(struct bme280_filter *f){
+    bool active = false;
+    unsigned int i;
+
+    for (i = 0; i < BME280_NCHAN; i++)
+        if (f->ch[i].type != BME280_FILTER_NONE || f->ch[i].spike)
+            active = true;
+    WRITE_ONCE(f->active, active);
+}
+
+void bme280_filter_init(struct bme280_filter *f){
+    unsigned int i;
+
+    mutex_init(&f->lock);
+    f->active = false;
+    f->spike_hold = 3;
+    atomic64_set(&f->rejected, 0);
+    for (i = 0; i < BME280_NCHAN; i++) {
+        f->ch[i].type = BME280_FILTER_NONE;
+        f->ch[i].alpha = BME280_FILTER_ALPHA_ONE;
+        f->ch[i].median_n = 3;
+        f->ch[i].spike = 0;
+        bme280_filter_chan_reset(&f->ch[i]);
+    }
+}
+
+static s32 bme280_filter_ewma(struct bme280_filter_chan *c, s32 x){
+    s64 x_q = (s64)x * BME280_FILTER_ALPHA_ONE;
+
+    if (!c->primed)
+        c->ewma_q = x_q;
+    else
+        c->ewma_q += ((x_q - c->ewma_q) * c->alpha + BME280_FILTER_ALPHA_ONE / 2) >> 16;
+    return (c->ewma_q + BME280_FILTER_ALPHA_ONE / 2) >> 16;
+}
+
+//Drops the oldest value from the sorted window once it is full, inserts the
+//newest, and returns the middle one (the upper middle while filling)
+static s32 bme280_filter_median(struct bme280_filter_chan *c, s32 x){
+    unsigned int n = c->median_n;
+    unsigned int i;
+
+    if (c->count == n) {
+        s32 old = c->ring[c->head];
+
+        for (i = 0; i < c->count - 1 && c->sorted[i] != old; i++)
+            ;
+        for (; i < c->count - 1; i++)
+            c->sorted[i] = c->sorted[i + 1];
+        c->count--;
+    }
+    c->ring[c->head] = x;
+    c->head = c->head + 1 == n ? 0 : c->head + 1;
+
+    for (i = c->count; i > 0 && c->sorted[i - 1] > x; i--)
+        c->sorted[i] = c->sorted[i - 1];
+    c->sorted[i] = x;
+    c->count++;
+    return c->sorted[c->count / 2];
+}
+
+static s32 bme280_filter_chan_step(struct bme280_filter *f, struct bme280_filter_chan *c, s32 x){
+    if (c->spike && c->primed && abs((s64)x - c->ref) > c->spike && c->rejects < f->spike_hold) {
+        c->rejects++;
+        atomic64_inc(&f->rejected);
+        x = c->ref;
+    } else {
+        c->rejects = 0;
+        c->ref = x;
+    }
+
+    switch (c->type) {
+    case BME280_FILTER_EWMA:
+        x = bme280_filter_ewma(c, x);
+        break;
+    case BME280_FILTER_MEDIAN:
+        x = bme280_filter_median(c, x);
+        break;
+    default:
+        break;
+    }
+    c->primed = true;
+    return x;
+}
+
+//Sampler side: filters r in place
+void bme280_filter_step(struct bme280_filter *f, struct bme280_reading *r){
+    unsigned int i;
+
+    if (!READ_ONCE(f->active))
+        return;
+    mutex_lock(&f->lock);
+    for (i = 0; i < BME280_NCHAN; i++)
+        r->val[i] = bme280_filter_chan_step(f, &f->ch[i], r->val[i]);
+    mutex_unlock(&f->lock);
+}
+
+// ---- SYSFS ----
+
+static ssize_t bme280_filter_type_show(struct bme280_filter *f, enum bme280_channel ch, char *buf){
+    struct bme280_filter_chan *c = &f->ch[ch];
+    ssize_t len;
+
+    mutex_lock(&f->lock);
+    switch (c->type) {
+    case BME280_FILTER_EWMA:
+        len = sprintf(buf, "ewma %u\n", c->alpha);
+        break;
+    case BME280_FILTER_MEDIAN:
+        len = sprintf(buf, "median %u\n", c->median_n);
+        break;
+    default:
+        len = sprintf(buf, "none\n");
+        break;
+    }
+    mutex_unlock(&f->lock);
+    return len;
+}
+
+static int bme280_filter_type_store(struct bme280_filter *f, enum bme280_channel ch, const char *buf){
+    struct bme280_filter_chan *c = &f->ch[ch];
+    enum bme280_filter_type type;
+    unsigned int arg = 0;
+    char name[8];
+    int n = sscanf(buf, "%7s %u", name, &arg);
+
+    if (n < 1)
+        return -EINVAL;
+    if (!strcmp(name, "none") && n == 1)
+        type = BME280_FILTER_NONE;
+    else if (!strcmp(name, "ewma") && n == 2 && arg >= 1 && arg <= BME280_FILTER_ALPHA_ONE)
+        type = BME280_FILTER_EWMA;
+    else if (!strcmp(name, "median") && n == 2 && (arg & 1) && arg >= 3 && arg <= BME280_FILTER_MEDIAN_MAX)
+        type = BME280_FILTER_MEDIAN;
+    else
+        return -EINVAL;
+
+    mutex_lock(&f->lock);
+    c->type = type;
+    if (type == BME280_FILTER_EWMA)
+        c->alpha = arg;
+    else if (type == BME280_FILTER_MEDIAN)
+        c->median_n = arg;
+    bme280_filter_chan_reset(c);
+    bme280_filter_update_active(f);
+    mutex_unlock(&f->lock);
+    return 0;
+}
+
+static int bme280_filter_spike_store(struct bme280_filter *f, enum bme280_channel ch, const char *buf){
+    unsigned int val;
+    int ret = kstrtouint(buf, 0, &val);
+
+    if (ret)
+        return ret;
+    if (val > UINT_MAX / bme280_channel_scale[ch])
+        return -ERANGE;
+    mutex_lock(&f->lock);
+    f->ch[ch].spike = val * bme280_channel_scale[ch];
+    f->ch[ch].rejects = 0;
+    bme280_filter_update_active(f);
+    mutex_unlock(&f->lock);
+    return 0;
+}
+
+#define BME280_FILTER_ATTRS(_name, _ch)                                          \
+static ssize_t _name##_show(struct device *dev,                                  \
+                            struct device_attribute *attr, char *buf)           \
+{                                                                                \
+    struct bme280_dev *bme = dev_get_drvdata(dev);                               \
+    return bme280_filter_type_show(&bme->chan_filter, _ch, buf);                 \
+}                                                                                \
+static ssize_t _name##_store(struct device *dev,                                 \
+                             struct device_attribute *attr,                     \
+                             const char *buf, size_t count)                     \
+{                                                                                \
+    struct bme280_dev *bme = dev_get_drvdata(dev);                               \
+    int ret = bme280_filter_type_store(&bme->chan_filter, _ch, buf);             \
+    return ret ? ret : count;                                                    \
+}                                                                                \
+static DEVICE_ATTR_RW(_name);                                                    \
+static ssize_t _name##_spike_show(struct device *dev,                            \
+                                  struct device_attribute *attr, char *buf)     \
+{                                                                                \
+    struct bme280_dev *bme = dev_get_drvdata(dev);                               \
+    return sprintf(buf, "%u\n",                                                  \
+                   READ_ONCE(bme->chan_filter.ch[_ch].spike) / bme280_channel_scale[_ch]); \
+}                                                                                \
+static ssize_t _name##_spike_store(struct device *dev,                           \
+                                   struct device_attribute *attr,               \
+                                   const char *buf, size_t count)               \
+{                                                                                \
+    struct bme280_dev *bme = dev_get_drvdata(dev);                               \
+    int ret = bme280_filter_spike_store(&bme->chan_filter, _ch, buf);            \
+    return ret ? ret : count;                                                    \
+}                                                                                \
+static DEVICE_ATTR_RW(_name##_spike)
+
+BME280_FILTER_ATTRS(temp_c, BME280_CH_TEMP);
+BME280_FILTER_ATTRS(pressure_pa, BME280_CH_PRESS);
+BME280_FILTER_ATTRS(humidity_percent, BME280_CH_HUMID);
+
+static ssize_t spike_hold_show(struct device *dev,
+                               struct device_attribute *attr,
+                               char *buf)
+{
+    struct bme280_dev *bme = dev_get_drvdata(dev);
+
+    return sprintf(buf, "%u\n", READ_ONCE(bme->chan_filter.spike_hold));
+}
+
+//Consecutive outliers replaced before the new level is accepted
+static ssize_t spike_hold_store(struct device *dev,
+                                struct device_attribute *attr,
+                                const char *buf, size_t count)
+{
+    struct bme280_dev *bme = dev_get_drvdata(dev);
+    unsigned int val;
+    int ret = kstrtouint(buf, 0, &val);
+
+    if (ret)
+        return ret;
+    mutex_lock(&bme->chan_filter.lock);
+    WRITE_ONCE(bme->chan_filter.spike_hold, val);
+    mutex_unlock(&bme->chan_filter.lock);
+    return count;
+}
+
+static DEVICE_ATTR_RW(spike_hold);
+
+//Inputs replaced by spike rejection
+static ssize_t rejected_show(struct device *dev,
+                             struct device_attribute *attr,
+                             char *buf)
+{
+    struct bme280_dev *bme = dev_get_drvdata(dev);
+
+    return sprintf(buf, "%lld\n", atomic64_read(&bme->chan_filter.rejected));
+}
+
+static DEVICE_ATTR_RO(rejected);
+
+static struct attribute *bme280_filter_attrs[] = {
+    &dev_attr_temp_c.attr,
+    &dev_attr_pressure_pa.attr,
+    &dev_attr_humidity_percent.attr,
+    &dev_attr_temp_c_spike.attr,
+    &dev_attr_pressure_pa_spike.attr,
+    &dev_attr_humidity_percent_spike.attr,
+    &dev_attr_spike_hold.attr,
+    &dev_attr_rejected.attr,
+    NULL,
+};
+
+const struct attribute_group bme280_filter_group = {
+    .name = "filter",
+    .attrs = bme280_filter_attrs,
+};
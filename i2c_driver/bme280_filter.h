@@ -0,0 +1,48 @@
+#include <linux/types.h>
+#ifndef BME280_FILTER_H
+#define BME280_FILTER_H
+#include <linux/atomic.h>
+#include <linux/mutex.h>
+#include "bme280_agg.h"
+//Per-channel smoothing at the full sample rate: spike rejection, then an EWMA
+//or a sliding median
+
+struct attribute_group;
+
+#define BME280_FILTER_MEDIAN_MAX 9
+#define BME280_FILTER_ALPHA_ONE 65536 //ewma alpha is Q16
+
+enum bme280_filter_type {
+    BME280_FILTER_NONE,
+    BME280_FILTER_EWMA,
+    BME280_FILTER_MEDIAN,
+};
+
+struct bme280_filter_chan {
+    enum bme280_filter_type type;
+    unsigned int alpha; //Q16, 1..65536 (65536 = no smoothing)
+    unsigned int median_n; //odd, 3..BME280_FILTER_MEDIAN_MAX
+    unsigned int spike; //reading units, 0 = off
+    bool primed;
+    s32 ref; //last accepted input, for spike rejection
+    unsigned int rejects; //consecutive inputs replaced by ref
+    s64 ewma_q; //Q16
+    unsigned int count, head;
+    s32 ring[BME280_FILTER_MEDIAN_MAX]; //inputs in arrival order
+    s32 sorted[BME280_FILTER_MEDIAN_MAX]; //the same values, ascending
+};
+
+struct bme280_filter {
+    struct mutex lock; //channel config and state; skipped while active is false
+    bool active; //some channel filters or rejects spikes
+    unsigned int spike_hold; //outliers in a row before they are taken as a real step
+    atomic64_t rejected;
+    struct bme280_filter_chan ch[BME280_NCHAN];
+};
+
+void bme280_filter_init(struct bme280_filter *f);
+void bme280_filter_step(struct bme280_filter *f, struct bme280_reading *r);
+
+//sysfs filter/ directory of the sensor device
+extern const struct attribute_group bme280_filter_group;
+#endif
@@ -0,0 +1,67 @@
+#include <linux/module.h>
+#include <linux/i2c.h>
+#include <net/genetlink.h>
+#include "bme280_genl.h"
+//Multicasts sample batches to every process that joined the "samples" group, so
+//any number of local consumers costs one skb per batch and no UDP loopback. When
+//nobody is subscribed the send is skipped before anything is allocated.
+
+static const struct genl_multicast_group bme280_genl_mcgrps[] = {
+    { .name = BME280_GENL_MCGRP_SAMPLES },
+};
+
+//No commands: the family only exists to carry the multicast group
+static struct genl_family bme280_genl_family __ro_after_init = {
+    .name = BME280_GENL_NAME,
+    .version = BME280_GENL_VERSION,
+    .maxattr = BME280_GENL_ATTR_MAX,
+    .module = THIS_MODULE,
+    .mcgrps = bme280_genl_mcgrps,
+    .n_mcgrps = ARRAY_SIZE(bme280_genl_mcgrps),
+};
+
+static void bme280_genl_multicast(const struct i2c_client *client, u8 cmd, int attr, const void *data, size_t len){
+    struct sk_buff *skb;
+    void *hdr;
+
+    if (!genl_has_listeners(&bme280_genl_family, &init_net, 0))
+        return;
+
+    skb = genlmsg_new(nla_total_size(sizeof(u32)) + nla_total_size(sizeof(u16)) +
+                      nla_total_size(len), GFP_KERNEL);
+    if (!skb)
+        return;
+    hdr = genlmsg_put(skb, 0, 0, &bme280_genl_family, 0, cmd);
+    if (!hdr)
+        goto err;
+    if (nla_put_u32(skb, BME280_GENL_ATTR_BUS, client->adapter->nr) ||
+        nla_put_u16(skb, BME280_GENL_ATTR_ADDR, client->addr) ||
+        nla_put(skb, attr, len, data))
+        goto err;
+    genlmsg_end(skb, hdr);
+    //-ESRCH if the last listener left in the meantime; a slow listener sees ENOBUFS on its socket
+    genlmsg_multicast(&bme280_genl_family, skb, 0, 0, GFP_KERNEL);
+    return;
+
+err:
+    nlmsg_free(skb);
+}
+
+//Called from the TX thread
+void bme280_genl_send(const struct i2c_client *client, const struct bme280_sensor_packet *pkts, unsigned int n){
+    if (n)
+        bme280_genl_multicast(client, BME280_GENL_CMD_SAMPLES, BME280_GENL_ATTR_SAMPLES, pkts, n * sizeof(*pkts));
+}
+
+//Called from the TX thread
+void bme280_genl_send_summary(const struct i2c_client *client, const struct bme280_summary_packet *sum){
+    bme280_genl_multicast(client, BME280_GENL_CMD_SUMMARY, BME280_GENL_ATTR_SUMMARY, sum, sizeof(*sum));
+}
+
+int bme280_genl_init(void){
+    return genl_register_family(&bme280_genl_family);
+}
+
+void bme280_genl_exit(void){
+    genl_unregister_family(&bme280_genl_family);
+}
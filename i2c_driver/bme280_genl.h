@@ -0,0 +1,13 @@
+#include <linux/types.h>
+#ifndef BME280_GENL_H
+#define BME280_GENL_H
+#include "bme280_uapi.h"
+//Generic netlink multicast sink, one family shared by all sensors
+
+struct i2c_client;
+
+int bme280_genl_init(void);
+void bme280_genl_exit(void);
+void bme280_genl_send(const struct i2c_client *client, const struct bme280_sensor_packet *pkts, unsigned int n);
+void bme280_genl_send_summary(const struct i2c_client *client, const struct bme280_summary_packet *sum);
+#endif
@@ -0,0 +1,152 @@
+#include <linux/module.h>
+#include <linux/i2c.h>
+#include <linux/iio/iio.h>
+#include <linux/iio/buffer.h>
+#include <linux/iio/trigger.h>
+#include <linux/iio/trigger_consumer.h>
+#include <linux/iio/triggered_buffer.h>
+#include "bme280.h"
+#include "bme280_iio.h"
+//In here lives the IIO front-end: in_temp/in_pressure/in_humidityrelative channels
+//plus a triggered buffer, so libiio/iio_readdev can stream samples using any IIO
+//trigger (e.g. iio-trig-hrtimer). Values go through the same compensation as the
+//sampling thread; raw * scale gives IIO units.
+
+enum { BME280_SCAN_TEMP, BME280_SCAN_PRESS, BME280_SCAN_HUMID, BME280_SCAN_TS };
+
+struct bme280_iio {
+    struct bme280_dev *bme;
+    //one scan: the three channels, then the timestamp aligned to 8 bytes
+    struct {
+        s32 chan[3];
+        s64 timestamp __aligned(8);
+    } scan;
+};
+
+#define BME280_IIO_CHAN(_type, _index, _sign)                        \
+    {                                                                \
+        .type = _type,                                               \
+        .info_mask_separate = BIT(IIO_CHAN_INFO_RAW) |               \
+                              BIT(IIO_CHAN_INFO_SCALE),              \
+        .scan_index = _index,                                        \
+        .scan_type = {                                               \
+            .sign = _sign,                                           \
+            .realbits = 32,                                          \
+            .storagebits = 32,                                       \
+            .endianness = IIO_CPU,                                   \
+        },                                                           \
+    }
+
+static const struct iio_chan_spec bme280_iio_channels[] = {
+    BME280_IIO_CHAN(IIO_TEMP, BME280_SCAN_TEMP, 's'),
+    BME280_IIO_CHAN(IIO_PRESSURE, BME280_SCAN_PRESS, 'u'),
+    BME280_IIO_CHAN(IIO_HUMIDITYRELATIVE, BME280_SCAN_HUMID, 'u'),
+    IIO_CHAN_SOFT_TIMESTAMP(BME280_SCAN_TS),
+};
+
+//The device always reads all three channels in one burst; the core demuxes
+//whatever subset the consumer enabled.
+static const unsigned long bme280_iio_scan_masks[] = {
+    BIT(BME280_SCAN_TEMP) | BIT(BME280_SCAN_PRESS) | BIT(BME280_SCAN_HUMID),
+    0
+};
+
+//raw values: temp 0.01 C, pressure Pa, humidity %RH * 1024
+static int bme280_iio_sample(struct bme280_iio *st, s32 chan[3]){
+    int32_t temp_c;
+    uint32_t press_q8, humid_q10;
+    int ret = bme280_read_compensated(st->bme, &temp_c, &press_q8, &humid_q10, NULL);
+
+    if (ret)
+        return ret;
+    chan[BME280_SCAN_TEMP] = temp_c;
+    chan[BME280_SCAN_PRESS] = press_q8 >> 8;
+    chan[BME280_SCAN_HUMID] = humid_q10;
+    return 0;
+}
+
+static irqreturn_t bme280_iio_trigger_handler(int irq, void *p){
+    struct iio_poll_func *pf = p;
+    struct iio_dev *indio_dev = pf->indio_dev;
+    struct bme280_iio *st = iio_priv(indio_dev);
+
+    if (bme280_iio_sample(st, st->scan.chan) == 0)
+        iio_push_to_buffers_with_timestamp(indio_dev, &st->scan, pf->timestamp);
+
+    iio_trigger_notify_done(indio_dev->trig);
+    return IRQ_HANDLED;
+}
+
+static int bme280_iio_read_raw(struct iio_dev *indio_dev,
+                               struct iio_chan_spec const *chan,
+                               int *val, int *val2, long mask)
+{
+    struct bme280_iio *st = iio_priv(indio_dev);
+    s32 sample[3];
+    int ret;
+
+    switch (mask) {
+    case IIO_CHAN_INFO_RAW:
+        ret = iio_device_claim_direct_mode(indio_dev);
+        if (ret)
+            return ret;
+        ret = bme280_iio_sample(st, sample);
+        iio_device_release_direct_mode(indio_dev);
+        if (ret)
+            return ret;
+        *val = sample[chan->scan_index];
+        return IIO_VAL_INT;
+    case IIO_CHAN_INFO_SCALE:
+        switch (chan->type) {
+        case IIO_TEMP: //0.01 C -> milli C
+            *val = 10;
+            return IIO_VAL_INT;
+        case IIO_PRESSURE: //Pa -> kPa
+            *val = 1;
+            *val2 = 1000;
+            return IIO_VAL_FRACTIONAL;
+        case IIO_HUMIDITYRELATIVE: //%RH * 1024 -> milli %RH
+            *val = 1000;
+            *val2 = 1024;
+            return IIO_VAL_FRACTIONAL;
+        default:
+            return -EINVAL;
+        }
+    default:
+        return -EINVAL;
+    }
+}
+
+static const struct iio_info bme280_iio_info = {
+    .read_raw = bme280_iio_read_raw,
+};
+
+//Everything is devm managed, so it goes away with the i2c client
+int bme280_iio_register(struct bme280_dev *bme){
+    struct i2c_client *client = bme->client;
+    struct iio_dev *indio_dev;
+    struct bme280_iio *st;
+    int ret;
+
+    indio_dev = devm_iio_device_alloc(&client->dev, sizeof(*st));
+    if (!indio_dev)
+        return -ENOMEM;
+    st = iio_priv(indio_dev);
+    st->bme = bme;
+
+    indio_dev->name = "bme280";
+    indio_dev->info = &bme280_iio_info;
+    indio_dev->modes = INDIO_DIRECT_MODE;
+    indio_dev->channels = bme280_iio_channels;
+    indio_dev->num_channels = ARRAY_SIZE(bme280_iio_channels);
+    indio_dev->available_scan_masks = bme280_iio_scan_masks;
+
+    ret = devm_iio_triggered_buffer_setup(&client->dev, indio_dev,
+                                          iio_pollfunc_store_time,
+                                          bme280_iio_trigger_handler,
+                                          NULL);
+    if (ret)
+        return ret;
+
+    return devm_iio_device_register(&client->dev, indio_dev);
+}
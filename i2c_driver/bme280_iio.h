@@ -0,0 +1,8 @@
+#include <linux/types.h>
+#ifndef BME280_IIO_H
+#define BME280_IIO_H
+
+struct bme280_dev;
+
+int bme280_iio_register(struct bme280_dev *bme);
+#endif
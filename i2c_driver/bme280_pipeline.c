@@ -0,0 +1,305 @@
+#include <linux/module.h>
+#include <linux/configfs.h>
+#include <linux/device.h>
+#include <linux/i2c.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include "bme280.h"
+#include "bme280_pipeline.h"
+//What happens to a sample after the read is a list of stages, run in order by
+//the sampler (bme280_sample()). A pipeline is set per sensor by creating a
+//configfs item named after the i2c device and writing its stages:
+//
+//  mkdir /sys/kernel/config/bme280/1-0076
+//  echo "filter decimate packet deadband udp" > /sys/kernel/config/bme280/1-0076/stages
+//
+//Items can be created before the device is probed and apply once it is; rmdir
+//puts the device back on the default pipeline. Stage parameters stay where they
+//were (sysfs filter/, decimate/, aggregate_window, deadband/); the pipeline only
+//decides which stages run and in what order.
+//
+//Rules, checked on write:
+//  - each stage at most once (their state lives in the device)
+//  - sinks after an encoder ("packet")
+//  - udp and netlink next to each other: they share the TX queue
+//  - aggregate only with a udp or netlink sink, the only outputs for summaries
+//Stages that drop a sample (decimate, deadband, aggregate) end its way through
+//the pipeline. An active aggregate stage queues its summaries to whichever
+//network sinks the pipeline has.
+//
+//The pipeline is published with RCU. The sampler copies it once per sample (it
+//is a few bytes) and runs the copy outside the read-side section, since the
+//stages take mutexes. Nothing is allocated on the sample path; a write allocates
+//the new pipeline and frees the old one after a grace period.
+
+static const char * const bme280_stage_names[BME280_NSTAGES] = {
+    [BME280_STAGE_FILTER] = "filter",
+    [BME280_STAGE_DECIMATE] = "decimate",
+    [BME280_STAGE_AGGREGATE] = "aggregate",
+    [BME280_STAGE_DEADBAND] = "deadband",
+    [BME280_STAGE_PACKET] = "packet",
+    [BME280_STAGE_CHARDEV] = "chardev",
+    [BME280_STAGE_UDP] = "udp",
+    [BME280_STAGE_NETLINK] = "netlink",
+};
+
+//The fixed order the driver had before pipelines were configurable. With no
+//filter, decimation, aggregation or deadband configured those stages pass
+//every sample, so this is also the plain read-and-send path.
+static struct bme280_pipeline bme280_pipeline_default = {
+    .nstages = 8,
+    .stages = {
+        BME280_STAGE_FILTER,
+        BME280_STAGE_DECIMATE,
+        BME280_STAGE_PACKET,
+        BME280_STAGE_CHARDEV,
+        BME280_STAGE_AGGREGATE,
+        BME280_STAGE_DEADBAND,
+        BME280_STAGE_UDP,
+        BME280_STAGE_NETLINK,
+    },
+    .net_sinks = BME280_SINK_UDP | BME280_SINK_NETLINK,
+};
+
+struct bme280_pipeline_item {
+    struct config_item item;
+    struct list_head node; //bme280_pipeline_items
+    struct bme280_pipeline cfg;
+};
+
+//Probed sensors and configfs items, matched by device name. Also serialises
+//pipeline updates.
+static LIST_HEAD(bme280_pipeline_devs);
+static LIST_HEAD(bme280_pipeline_items);
+static DEFINE_MUTEX(bme280_pipeline_lock);
+
+static struct bme280_pipeline_item *to_pipeline_item(struct config_item *item){
+    return container_of(item, struct bme280_pipeline_item, item);
+}
+
+//With bme280_pipeline_lock held. A failed allocation keeps the old pipeline.
+static int bme280_pipeline_install(struct bme280_dev *bme, const struct bme280_pipeline *cfg){
+    struct bme280_pipeline *new = &bme280_pipeline_default;
+    struct bme280_pipeline *old;
+
+    if (cfg != &bme280_pipeline_default) {
+        new = kmemdup(cfg, sizeof(*cfg), GFP_KERNEL);
+        if (!new)
+            return -ENOMEM;
+    }
+    old = rcu_replace_pointer(bme->pipeline, new, lockdep_is_held(&bme280_pipeline_lock));
+    if (old != &bme280_pipeline_default)
+        kfree_rcu(old, rcu);
+    return 0;
+}
+
+static struct bme280_dev *bme280_pipeline_find_dev(const char *name){
+    struct bme280_dev *bme;
+
+    list_for_each_entry(bme, &bme280_pipeline_devs, pipeline_node)
+        if (!strcmp(dev_name(&bme->client->dev), name))
+            return bme;
+    return NULL;
+}
+
+static int bme280_pipeline_parse(const char *page, struct bme280_pipeline *p){
+    unsigned long used = 0;
+    char buf[128];
+    char *s = buf, *tok;
+    int stage;
+
+    if (strscpy(buf, page, sizeof(buf)) < 0)
+        return -E2BIG;
+    memset(p, 0, sizeof(*p));
+    while ((tok = strsep(&s, " \t\n"))) {
+        if (!*tok)
+            continue;
+        stage = match_string(bme280_stage_names, BME280_NSTAGES, tok);
+        if (stage < 0 || (used & BIT(stage)))
+            return -EINVAL;
+        //sinks are the last stages of the enum
+        if (stage >= BME280_STAGE_CHARDEV && !(used & BIT(BME280_STAGE_PACKET)))
+            return -EINVAL;
+        if (stage == BME280_STAGE_UDP || stage == BME280_STAGE_NETLINK) {
+            if (p->net_sinks && p->stages[p->nstages - 1] != BME280_STAGE_UDP &&
+                p->stages[p->nstages - 1] != BME280_STAGE_NETLINK)
+                return -EINVAL;
+            p->net_sinks |= stage == BME280_STAGE_UDP ? BME280_SINK_UDP : BME280_SINK_NETLINK;
+        }
+        used |= BIT(stage);
+        p->stages[p->nstages++] = stage;
+    }
+    if ((used & BIT(BME280_STAGE_AGGREGATE)) && !p->net_sinks)
+        return -EINVAL;
+    return 0;
+}
+
+// ---- CONFIGFS ----
+
+static ssize_t bme280_pipeline_stages_show(struct config_item *item, char *page){
+    struct bme280_pipeline_item *pi = to_pipeline_item(item);
+    ssize_t len = 0;
+    unsigned int i;
+
+    mutex_lock(&bme280_pipeline_lock);
+    for (i = 0; i < pi->cfg.nstages; i++)
+        len += sprintf(page + len, "%s%s", i ? " " : "", bme280_stage_names[pi->cfg.stages[i]]);
+    mutex_unlock(&bme280_pipeline_lock);
+    len += sprintf(page + len, "\n");
+    return len;
+}
+
+//Takes effect on the device's next sample
+static ssize_t bme280_pipeline_stages_store(struct config_item *item, const char *page, size_t len){
+    struct bme280_pipeline_item *pi = to_pipeline_item(item);
+    struct bme280_pipeline cfg;
+    struct bme280_dev *bme;
+    int ret = bme280_pipeline_parse(page, &cfg);
+
+    if (ret)
+        return ret;
+    mutex_lock(&bme280_pipeline_lock);
+    bme = bme280_pipeline_find_dev(config_item_name(item));
+    if (bme)
+        ret = bme280_pipeline_install(bme, &cfg);
+    if (!ret)
+        pi->cfg = cfg;
+    mutex_unlock(&bme280_pipeline_lock);
+    return ret ? ret : len;
+}
+
+//1 while a sensor of this name is probed and running the pipeline
+static ssize_t bme280_pipeline_bound_show(struct config_item *item, char *page){
+    bool bound;
+
+    mutex_lock(&bme280_pipeline_lock);
+    bound = bme280_pipeline_find_dev(config_item_name(item));
+    mutex_unlock(&bme280_pipeline_lock);
+    return sprintf(page, "%d\n", bound);
+}
+
+CONFIGFS_ATTR(bme280_pipeline_, stages);
+CONFIGFS_ATTR_RO(bme280_pipeline_, bound);
+
+static struct configfs_attribute *bme280_pipeline_attrs[] = {
+    &bme280_pipeline_attr_stages,
+    &bme280_pipeline_attr_bound,
+    NULL,
+};
+
+static void bme280_pipeline_release(struct config_item *item){
+    kfree(to_pipeline_item(item));
+}
+
+static struct configfs_item_operations bme280_pipeline_item_ops = {
+    .release = bme280_pipeline_release,
+};
+
+static const struct config_item_type bme280_pipeline_type = {
+    .ct_item_ops = &bme280_pipeline_item_ops,
+    .ct_attrs = bme280_pipeline_attrs,
+    .ct_owner = THIS_MODULE,
+};
+
+//A new item starts as the default pipeline, so creating it changes nothing
+static struct config_item *bme280_pipeline_make_item(struct config_group *group, const char *name){
+    struct bme280_pipeline_item *pi = kzalloc(sizeof(*pi), GFP_KERNEL);
+
+    if (!pi)
+        return ERR_PTR(-ENOMEM);
+    pi->cfg = bme280_pipeline_default;
+    config_item_init_type_name(&pi->item, name, &bme280_pipeline_type);
+    mutex_lock(&bme280_pipeline_lock);
+    list_add_tail(&pi->node, &bme280_pipeline_items);
+    mutex_unlock(&bme280_pipeline_lock);
+    return &pi->item;
+}
+
+static void bme280_pipeline_drop_item(struct config_group *group, struct config_item *item){
+    struct bme280_pipeline_item *pi = to_pipeline_item(item);
+    struct bme280_dev *bme;
+
+    mutex_lock(&bme280_pipeline_lock);
+    list_del(&pi->node);
+    bme = bme280_pipeline_find_dev(config_item_name(item));
+    if (bme)
+        bme280_pipeline_install(bme, &bme280_pipeline_default);
+    mutex_unlock(&bme280_pipeline_lock);
+    config_item_put(item);
+}
+
+static struct configfs_group_operations bme280_pipeline_group_ops = {
+    .make_item = bme280_pipeline_make_item,
+    .drop_item = bme280_pipeline_drop_item,
+};
+
+static const struct config_item_type bme280_pipeline_group_type = {
+    .ct_group_ops = &bme280_pipeline_group_ops,
+    .ct_owner = THIS_MODULE,
+};
+
+static struct configfs_subsystem bme280_pipeline_subsys = {
+    .su_group = {
+        .cg_item = {
+            .ci_namebuf = "bme280",
+            .ci_type = &bme280_pipeline_group_type,
+        },
+    },
+};
+
+int bme280_pipeline_init(void){
+    config_group_init(&bme280_pipeline_subsys.su_group);
+    mutex_init(&bme280_pipeline_subsys.su_mutex);
+    return configfs_register_subsystem(&bme280_pipeline_subsys);
+}
+
+void bme280_pipeline_exit(void){
+    configfs_unregister_subsystem(&bme280_pipeline_subsys);
+}
+
+// ---- DEVICE SIDE ----
+
+//Before the TX thread and the sampler start. Picks up an item made before probe;
+//if its pipeline cannot be allocated the sensor runs the default one.
+void bme280_pipeline_attach(struct bme280_dev *bme){
+    struct bme280_pipeline_item *pi;
+
+    RCU_INIT_POINTER(bme->pipeline, &bme280_pipeline_default);
+    mutex_lock(&bme280_pipeline_lock);
+    list_add_tail(&bme->pipeline_node, &bme280_pipeline_devs);
+    list_for_each_entry(pi, &bme280_pipeline_items, node) {
+        if (!strcmp(config_item_name(&pi->item), dev_name(&bme->client->dev))) {
+            if (bme280_pipeline_install(bme, &pi->cfg))
+                pr_warn("%s: configfs pipeline not applied, using the default\n",
+                        dev_name(&bme->client->dev));
+            break;
+        }
+    }
+    mutex_unlock(&bme280_pipeline_lock);
+}
+
+//After the sampler and the TX thread have stopped
+void bme280_pipeline_detach(struct bme280_dev *bme){
+    mutex_lock(&bme280_pipeline_lock);
+    list_del(&bme->pipeline_node);
+    bme280_pipeline_install(bme, &bme280_pipeline_default);
+    mutex_unlock(&bme280_pipeline_lock);
+}
+
+//Sampler: a private copy for one sample
+void bme280_pipeline_get(struct bme280_dev *bme, struct bme280_pipeline *p){
+    rcu_read_lock();
+    *p = *rcu_dereference(bme->pipeline);
+    rcu_read_unlock();
+}
+
+unsigned int bme280_pipeline_net_sinks(struct bme280_dev *bme){
+    unsigned int sinks;
+
+    rcu_read_lock();
+    sinks = rcu_dereference(bme->pipeline)->net_sinks;
+    rcu_read_unlock();
+    return sinks;
+}
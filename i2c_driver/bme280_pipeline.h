@@ -0,0 +1,38 @@
+#include <linux/types.h>
+#ifndef BME280_PIPELINE_H
+#define BME280_PIPELINE_H
+#include <linux/rcupdate.h>
+//Per-sensor processing pipeline, defined through configfs bme280/<device>/stages
+
+struct bme280_dev;
+
+enum bme280_stage {
+    BME280_STAGE_FILTER,    //filter/ (EWMA, median, spike rejection)
+    BME280_STAGE_DECIMATE,  //decimate/, passes one sample in 'factor'
+    BME280_STAGE_AGGREGATE, //aggregate_window, consumes samples and emits summaries
+    BME280_STAGE_DEADBAND,  //deadband/, passes changed samples and heartbeats
+    BME280_STAGE_PACKET,    //encoder: sensor packet, also what sysfs read_sensor reports
+    BME280_STAGE_CHARDEV,   //sink: /dev/bme280-<device>
+    BME280_STAGE_UDP,       //sink: UDP to dest_ip:dest_port
+    BME280_STAGE_NETLINK,   //sink: generic netlink multicast
+    BME280_NSTAGES,
+};
+
+#define BME280_SINK_UDP     BIT(0)
+#define BME280_SINK_NETLINK BIT(1)
+
+//Immutable once published; a new config replaces the whole struct
+struct bme280_pipeline {
+    struct rcu_head rcu;
+    unsigned int nstages;
+    u8 stages[BME280_NSTAGES];
+    unsigned int net_sinks; //for the TX thread, which sends samples and summaries
+};
+
+int bme280_pipeline_init(void);
+void bme280_pipeline_exit(void);
+void bme280_pipeline_attach(struct bme280_dev *bme);
+void bme280_pipeline_detach(struct bme280_dev *bme);
+void bme280_pipeline_get(struct bme280_dev *bme, struct bme280_pipeline *p);
+unsigned int bme280_pipeline_net_sinks(struct bme280_dev *bme);
+#endif
@@ -0,0 +1,175 @@
+#include <linux/module.h>
+#include <linux/device.h>
+#include <linux/sched.h>
+#include <linux/sched/types.h>
+#include <linux/cpumask.h>
+#include <linux/slab.h>
+#include "bme280.h"
+#include "bme280_sched.h"
+//Lets a deployment take the sampler out of CFS so host load stops showing up as
+//loop period jitter. Exposed per sensor as sysfs sched/{policy,fifo_prio,
+//dl_runtime_us,dl_period_us,cpus}; the initial values come from module params.
+//The settings belong to the adapter's worker, so they are shared by all sensors
+//on the same bus.
+//
+//SCHED_DEADLINE admission control rejects tasks whose affinity is narrower than
+//their root domain, so pinning with cpus only works for normal and fifo (or with
+//an isolated cpuset partition set up from userspace).
+
+#define BME280_DL_MIN_RUNTIME_US 2 //the kernel refuses runtimes below 1024 ns
+
+static const char *const bme280_policy_names[] = {
+    [SCHED_NORMAL] = "normal",
+    [SCHED_FIFO] = "fifo",
+    [SCHED_DEADLINE] = "deadline",
+};
+
+int bme280_sched_policy_from_name(const char *name){
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(bme280_policy_names); i++)
+        if (bme280_policy_names[i] && sysfs_streq(name, bme280_policy_names[i]))
+            return i;
+    return -EINVAL;
+}
+
+int bme280_sched_apply(struct task_struct *t, const struct bme280_sched *s){
+    struct sched_attr attr = {
+        .size = sizeof(attr),
+        .sched_policy = s->policy,
+    };
+
+    switch (s->policy) {
+    case SCHED_FIFO:
+        if (s->fifo_prio < 1 || s->fifo_prio > MAX_RT_PRIO - 1)
+            return -EINVAL;
+        attr.sched_priority = s->fifo_prio;
+        break;
+    case SCHED_DEADLINE:
+        if (s->dl_runtime_us < BME280_DL_MIN_RUNTIME_US || s->dl_runtime_us > s->dl_period_us)
+            return -EINVAL;
+        attr.sched_runtime = (u64)s->dl_runtime_us * NSEC_PER_USEC;
+        attr.sched_deadline = (u64)s->dl_period_us * NSEC_PER_USEC;
+        attr.sched_period = attr.sched_deadline;
+        break;
+    case SCHED_NORMAL:
+        break;
+    default:
+        return -EINVAL;
+    }
+    return sched_setattr_nocheck(t, &attr);
+}
+
+int bme280_sched_set_cpus(struct task_struct *t, const char *cpulist){
+    cpumask_var_t mask;
+    int ret;
+
+    if (!alloc_cpumask_var(&mask, GFP_KERNEL))
+        return -ENOMEM;
+    ret = cpulist_parse(cpulist, mask);
+    if (!ret && !cpumask_intersects(mask, cpu_online_mask))
+        ret = -EINVAL;
+    if (!ret)
+        ret = set_cpus_allowed_ptr(t, mask);
+    free_cpumask_var(mask);
+    return ret;
+}
+
+//Tries one changed setting on a copy and keeps it only if the kernel accepted it
+//(valid combination, deadline admission control passed)
+static ssize_t bme280_sched_store(struct device *dev, size_t count, size_t offset, unsigned int val){
+    struct bme280_dev *bme = dev_get_drvdata(dev);
+    struct bme280_bus *bus = bme->bus;
+    struct bme280_sched s;
+    int ret;
+
+    mutex_lock(&bus->sched_lock);
+    s = bus->sched;
+    *(unsigned int *)((u8 *)&s + offset) = val;
+    ret = bme280_sched_apply(bus->thread, &s);
+    if (!ret)
+        bus->sched = s;
+    mutex_unlock(&bus->sched_lock);
+    return ret ? ret : count;
+}
+
+static ssize_t policy_show(struct device *dev,
+                           struct device_attribute *attr,
+                           char *buf)
+{
+    struct bme280_dev *bme = dev_get_drvdata(dev);
+
+    return sprintf(buf, "%s\n", bme280_policy_names[READ_ONCE(bme->bus->sched.policy)]);
+}
+
+static ssize_t policy_store(struct device *dev,
+                            struct device_attribute *attr,
+                            const char *buf, size_t count)
+{
+    int policy = bme280_sched_policy_from_name(buf);
+
+    if (policy < 0)
+        return policy;
+    return bme280_sched_store(dev, count, offsetof(struct bme280_sched, policy), policy);
+}
+
+static DEVICE_ATTR_RW(policy);
+
+#define BME280_SCHED_UINT_ATTR(_name)                                             \
+static ssize_t _name##_show(struct device *dev,                                  \
+                            struct device_attribute *attr, char *buf)           \
+{                                                                                \
+    struct bme280_dev *bme = dev_get_drvdata(dev);                               \
+    return sprintf(buf, "%u\n", READ_ONCE(bme->bus->sched._name));                    \
+}                                                                                \
+static ssize_t _name##_store(struct device *dev,                                 \
+                             struct device_attribute *attr,                     \
+                             const char *buf, size_t count)                     \
+{                                                                                \
+    unsigned int val;                                                            \
+    int ret = kstrtouint(buf, 0, &val);                                          \
+    if (ret)                                                                     \
+        return ret;                                                              \
+    return bme280_sched_store(dev, count, offsetof(struct bme280_sched, _name), val); \
+}                                                                                \
+static DEVICE_ATTR_RW(_name)
+
+BME280_SCHED_UINT_ATTR(fifo_prio);
+BME280_SCHED_UINT_ATTR(dl_runtime_us);
+BME280_SCHED_UINT_ATTR(dl_period_us);
+
+static ssize_t cpus_show(struct device *dev,
+                         struct device_attribute *attr,
+                         char *buf)
+{
+    struct bme280_dev *bme = dev_get_drvdata(dev);
+
+    return sprintf(buf, "%*pbl\n", cpumask_pr_args(bme->bus->thread->cpus_ptr));
+}
+
+//cpulist format, e.g. "3" or "2-3"
+static ssize_t cpus_store(struct device *dev,
+                          struct device_attribute *attr,
+                          const char *buf, size_t count)
+{
+    struct bme280_dev *bme = dev_get_drvdata(dev);
+    int ret = bme280_sched_set_cpus(bme->bus->thread, buf);
+
+    return ret ? ret : count;
+}
+
+static DEVICE_ATTR_RW(cpus);
+
+static struct attribute *bme280_sched_attrs[] = {
+    &dev_attr_policy.attr,
+    &dev_attr_fifo_prio.attr,
+    &dev_attr_dl_runtime_us.attr,
+    &dev_attr_dl_period_us.attr,
+    &dev_attr_cpus.attr,
+    NULL,
+};
+
+const struct attribute_group bme280_sched_group = {
+    .name = "sched",
+    .attrs = bme280_sched_attrs,
+};
@@ -0,0 +1,23 @@
+#include <linux/types.h>
+#ifndef BME280_SCHED_H
+#define BME280_SCHED_H
+//Scheduling class and CPU placement of an adapter's sampling worker
+
+struct task_struct;
+struct attribute_group;
+
+//Plain values so a change can be tried on a copy; bme280_bus.sched_lock guards them
+struct bme280_sched {
+    unsigned int policy; //SCHED_NORMAL, SCHED_FIFO or SCHED_DEADLINE
+    unsigned int fifo_prio; //1..99
+    unsigned int dl_runtime_us; //CPU budget per dl_period_us, deadline = period
+    unsigned int dl_period_us;
+};
+
+int bme280_sched_policy_from_name(const char *name);
+int bme280_sched_apply(struct task_struct *t, const struct bme280_sched *s);
+int bme280_sched_set_cpus(struct task_struct *t, const char *cpulist);
+
+//sysfs sched/ directory of the sensor device
+extern const struct attribute_group bme280_sched_group;
+#endif
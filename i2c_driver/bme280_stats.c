@@ -0,0 +1,208 @@
+#include <linux/module.h>
+#include <linux/device.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/bitops.h>
+#include <linux/math64.h>
+#include <linux/slab.h>
+#include <linux/timekeeping.h>
+#include "bme280_stats.h"
+//Histograms are updated by the sampler and the timer callback with a handful of
+//atomic ops and no lock, so jitter can be measured at high rates without the cost
+//of logging every loop.
+//Each file reads as a summary (count, min, mean, p50, p99, p99.9, max) followed by
+//the non-empty buckets; writing anything to it resets that histogram.
+
+static struct dentry *bme280_debugfs_root;
+
+static const char *const bme280_hist_names[BME280_HIST_COUNT] = {
+    [BME280_HIST_PERIOD] = "loop_period",
+    [BME280_HIST_EXEC] = "loop_exec",
+    [BME280_HIST_I2C] = "i2c",
+    [BME280_HIST_SEND] = "send",
+    [BME280_HIST_E2E] = "e2e",
+    [BME280_HIST_TIMER] = "timer",
+    [BME280_HIST_WAKEUP] = "wakeup",
+};
+
+static unsigned int bme280_hist_bucket(u64 v){
+    unsigned int shift;
+
+    if (v >= 1ULL << BME280_HIST_MAX_BITS)
+        v = (1ULL << BME280_HIST_MAX_BITS) - 1;
+    if (v < BME280_HIST_SUB)
+        return v;
+    shift = fls64(v) - 1 - BME280_HIST_SUB_BITS;
+    return (shift + 1) * BME280_HIST_SUB + ((v >> shift) & (BME280_HIST_SUB - 1));
+}
+
+static u64 bme280_hist_bucket_lo(unsigned int i){
+    if (i < BME280_HIST_SUB)
+        return i;
+    return (u64)(BME280_HIST_SUB + i % BME280_HIST_SUB) << (i / BME280_HIST_SUB - 1);
+}
+
+static u64 bme280_hist_bucket_hi(unsigned int i){
+    if (i < BME280_HIST_SUB)
+        return i;
+    return bme280_hist_bucket_lo(i) + (1ULL << (i / BME280_HIST_SUB - 1)) - 1;
+}
+
+static void bme280_hist_reset(struct bme280_hist *h){
+    unsigned int i;
+
+    for (i = 0; i < BME280_HIST_BUCKETS; i++)
+        atomic64_set(&h->buckets[i], 0);
+    atomic64_set(&h->count, 0);
+    atomic64_set(&h->sum, 0);
+    atomic64_set(&h->min, S64_MAX);
+    atomic64_set(&h->max, 0);
+    atomic64_set(&h->max_at, 0);
+}
+
+void bme280_stats_record(struct bme280_stats *st, enum bme280_hist_id id, u64 ns){
+    struct bme280_hist *h;
+    s64 old;
+
+    if (!st)
+        return;
+    h = &st->hist[id];
+    atomic64_inc(&h->buckets[bme280_hist_bucket(ns)]);
+    atomic64_inc(&h->count);
+    atomic64_add(ns, &h->sum);
+
+    old = atomic64_read(&h->min);
+    while ((s64)ns < old && !atomic64_try_cmpxchg(&h->min, &old, ns))
+        ;
+    old = atomic64_read(&h->max);
+    while ((s64)ns > old) {
+        if (atomic64_try_cmpxchg(&h->max, &old, ns)) {
+            //when the worst case happened, to line it up with other traces
+            atomic64_set(&h->max_at, ktime_get_ns());
+            break;
+        }
+    }
+}
+
+//Upper edge of the bucket holding the rank-th sample, clamped to the observed max.
+//Quantiles are in parts per 1000.
+static void bme280_hist_quantiles(struct bme280_hist *h, u64 total, const unsigned int *q,
+                                  u64 *out, unsigned int n){
+    u64 max = atomic64_read(&h->max);
+    u64 seen = 0;
+    unsigned int i, k = 0;
+
+    for (i = 0; i < n; i++)
+        out[i] = max;
+    for (i = 0; i < BME280_HIST_BUCKETS && k < n; i++) {
+        seen += atomic64_read(&h->buckets[i]);
+        //rank = ceil(total * q / 1000)
+        while (k < n && seen * 1000 >= total * q[k]) {
+            out[k] = min(bme280_hist_bucket_hi(i), max);
+            k++;
+        }
+    }
+}
+
+static int bme280_hist_show(struct seq_file *s, void *unused){
+    static const unsigned int q[] = { 500, 990, 999 };
+    struct bme280_hist *h = s->private;
+    u64 count = atomic64_read(&h->count);
+    u64 pct[ARRAY_SIZE(q)];
+    unsigned int i;
+
+    seq_printf(s, "count %llu\n", count);
+    if (!count)
+        return 0;
+    bme280_hist_quantiles(h, count, q, pct, ARRAY_SIZE(q));
+    seq_printf(s, "min_ns %lld\n", atomic64_read(&h->min));
+    seq_printf(s, "mean_ns %llu\n", div64_u64(atomic64_read(&h->sum), count));
+    seq_printf(s, "p50_ns %llu\n", pct[0]);
+    seq_printf(s, "p99_ns %llu\n", pct[1]);
+    seq_printf(s, "p99.9_ns %llu\n", pct[2]);
+    seq_printf(s, "max_ns %lld\n", atomic64_read(&h->max));
+    seq_printf(s, "max_at_ns %lld\n", atomic64_read(&h->max_at));
+
+    seq_puts(s, "# lo_ns hi_ns count\n");
+    for (i = 0; i < BME280_HIST_BUCKETS; i++) {
+        s64 n = atomic64_read(&h->buckets[i]);
+
+        if (n)
+            seq_printf(s, "%llu %llu %lld\n", bme280_hist_bucket_lo(i), bme280_hist_bucket_hi(i), n);
+    }
+    return 0;
+}
+
+static int bme280_hist_open(struct inode *inode, struct file *file){
+    return single_open(file, bme280_hist_show, inode->i_private);
+}
+
+static ssize_t bme280_hist_write(struct file *file, const char __user *buf, size_t count, loff_t *ppos){
+    struct seq_file *s = file->private_data;
+
+    bme280_hist_reset(s->private);
+    return count;
+}
+
+static const struct file_operations bme280_hist_fops = {
+    .owner = THIS_MODULE,
+    .open = bme280_hist_open,
+    .read = seq_read,
+    .write = bme280_hist_write,
+    .llseek = seq_lseek,
+    .release = single_release,
+};
+
+static ssize_t bme280_reset_write(struct file *file, const char __user *buf, size_t count, loff_t *ppos){
+    struct bme280_stats *st = file->private_data;
+    unsigned int i;
+
+    for (i = 0; i < BME280_HIST_COUNT; i++)
+        bme280_hist_reset(&st->hist[i]);
+    return count;
+}
+
+static const struct file_operations bme280_reset_fops = {
+    .owner = THIS_MODULE,
+    .open = simple_open,
+    .write = bme280_reset_write,
+    .llseek = noop_llseek,
+};
+
+static void bme280_stats_release(void *data){
+    struct bme280_stats *st = data;
+
+    debugfs_remove_recursive(st->dir);
+    kvfree(st);
+}
+
+//devm-managed: the debugfs directory goes away, and then the histograms, after
+//the driver's remove() has stopped the sampler.
+struct bme280_stats *bme280_stats_create(struct device *dev){
+    struct bme280_stats *st = kvzalloc(sizeof(*st), GFP_KERNEL);
+    unsigned int i;
+    int ret;
+
+    if (!st)
+        return ERR_PTR(-ENOMEM);
+    for (i = 0; i < BME280_HIST_COUNT; i++)
+        bme280_hist_reset(&st->hist[i]);
+
+    st->dir = debugfs_create_dir(dev_name(dev), bme280_debugfs_root);
+    for (i = 0; i < BME280_HIST_COUNT; i++)
+        debugfs_create_file(bme280_hist_names[i], 0600, st->dir, &st->hist[i], &bme280_hist_fops);
+    debugfs_create_file("reset", 0200, st->dir, st, &bme280_reset_fops);
+
+    ret = devm_add_action_or_reset(dev, bme280_stats_release, st);
+    if (ret)
+        return ERR_PTR(ret);
+    return st;
+}
+
+void bme280_stats_init(void){
+    bme280_debugfs_root = debugfs_create_dir("bme280", NULL);
+}
+
+void bme280_stats_exit(void){
+    debugfs_remove_recursive(bme280_debugfs_root);
+}
@@ -0,0 +1,48 @@
+#include <linux/types.h>
+#ifndef BME280_STATS_H
+#define BME280_STATS_H
+#include <linux/atomic.h>
+//Per-sensor latency histograms, exported through debugfs as bme280/<device>/
+
+struct device;
+
+//Log-linear buckets: values below 16 ns get one bucket each, every power of two
+//above that is split into 16 equal buckets (<= 6.25% relative error). Values are
+//clamped at 2^40 ns (~18 min).
+#define BME280_HIST_SUB_BITS 4
+#define BME280_HIST_SUB      (1 << BME280_HIST_SUB_BITS)
+#define BME280_HIST_MAX_BITS 40
+#define BME280_HIST_BUCKETS  ((BME280_HIST_MAX_BITS - BME280_HIST_SUB_BITS + 1) * BME280_HIST_SUB)
+
+enum bme280_hist_id {
+    BME280_HIST_PERIOD, //loop start to loop start
+    BME280_HIST_EXEC,   //loop start to loop end
+    BME280_HIST_I2C,    //burst data read
+    BME280_HIST_SEND,   //kernel_sendmsg()
+    BME280_HIST_E2E,    //read start to last sink done
+    BME280_HIST_TIMER,  //hrtimer expiry to its callback (irq latency)
+    BME280_HIST_WAKEUP, //hrtimer expiry to the sampler running (irq + scheduler)
+    BME280_HIST_COUNT,
+};
+
+//Counters are atomics so a record never takes a lock and a reset from debugfs
+//can race with the sampler; at worst a sample straddling the reset is lost.
+struct bme280_hist {
+    atomic64_t buckets[BME280_HIST_BUCKETS];
+    atomic64_t count;
+    atomic64_t sum;
+    atomic64_t min;
+    atomic64_t max;
+    atomic64_t max_at; //CLOCK_MONOTONIC ns when max was recorded
+};
+
+struct bme280_stats {
+    struct bme280_hist hist[BME280_HIST_COUNT];
+    struct dentry *dir;
+};
+
+void bme280_stats_init(void);
+void bme280_stats_exit(void);
+struct bme280_stats *bme280_stats_create(struct device *dev);
+void bme280_stats_record(struct bme280_stats *st, enum bme280_hist_id id, u64 ns);
+#endif
@@ -0,0 +1,112 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM bme280
+
+#if !defined(_BME280_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _BME280_TRACE_H
+//Sampling hot path tracepoints. Each one is a patched-out branch until enabled via
+//tracefs (events/bme280/), perf or bpftrace. Devices are identified by bus/addr.
+
+#include <linux/tracepoint.h>
+#include <linux/i2c.h>
+
+TRACE_EVENT(bme280_sample_read,
+    TP_PROTO(const struct i2c_client *client, int32_t adc_T, int32_t adc_P, int32_t adc_H, u64 bus_ns),
+    TP_ARGS(client, adc_T, adc_P, adc_H, bus_ns),
+    TP_STRUCT__entry(
+        __field(int, bus)
+        __field(u16, addr)
+        __field(s32, adc_T)
+        __field(s32, adc_P)
+        __field(s32, adc_H)
+        __field(u64, bus_ns)
+    ),
+    TP_fast_assign(
+        __entry->bus = client->adapter->nr;
+        __entry->addr = client->addr;
+        __entry->adc_T = adc_T;
+        __entry->adc_P = adc_P;
+        __entry->adc_H = adc_H;
+        __entry->bus_ns = bus_ns;
+    ),
+    TP_printk("%d-%04x adc_T=%d adc_P=%d adc_H=%d bus_ns=%llu",
+              __entry->bus, __entry->addr, __entry->adc_T, __entry->adc_P,
+              __entry->adc_H, __entry->bus_ns)
+);
+
+TRACE_EVENT(bme280_compensate,
+    TP_PROTO(const struct i2c_client *client, int32_t temp_c, uint32_t press_q8, uint32_t humid_q10),
+    TP_ARGS(client, temp_c, press_q8, humid_q10),
+    TP_STRUCT__entry(
+        __field(int, bus)
+        __field(u16, addr)
+        __field(s32, temp_c)
+        __field(u32, press_q8)
+        __field(u32, humid_q10)
+    ),
+    TP_fast_assign(
+        __entry->bus = client->adapter->nr;
+        __entry->addr = client->addr;
+        __entry->temp_c = temp_c;
+        __entry->press_q8 = press_q8;
+        __entry->humid_q10 = humid_q10;
+    ),
+    TP_printk("%d-%04x temp=%d (0.01C) press=%u (Pa/256) humid=%u (%%RH/1024)",
+              __entry->bus, __entry->addr, __entry->temp_c,
+              __entry->press_q8, __entry->humid_q10)
+);
+
+TRACE_EVENT(bme280_send,
+    TP_PROTO(const struct i2c_client *client, size_t len, int ret, u64 send_ns),
+    TP_ARGS(client, len, ret, send_ns),
+    TP_STRUCT__entry(
+        __field(int, bus)
+        __field(u16, addr)
+        __field(u32, len)
+        __field(int, ret)
+        __field(u64, send_ns)
+    ),
+    TP_fast_assign(
+        __entry->bus = client->adapter->nr;
+        __entry->addr = client->addr;
+        __entry->len = len;
+        __entry->ret = ret;
+        __entry->send_ns = send_ns;
+    ),
+    TP_printk("%d-%04x len=%u ret=%d send_ns=%llu",
+              __entry->bus, __entry->addr, __entry->len, __entry->ret, __entry->send_ns)
+);
+
+//period_ns is 0 for the first loop. wakeup_ns is the sampling deadline to the loop
+//starting, i.e. timer irq plus scheduler latency, with no bus or send time in it.
+TRACE_EVENT(bme280_loop,
+    TP_PROTO(const struct i2c_client *client, u64 period_ns, u64 wakeup_ns, u64 exec_ns, u64 e2e_ns),
+    TP_ARGS(client, period_ns, wakeup_ns, exec_ns, e2e_ns),
+    TP_STRUCT__entry(
+        __field(int, bus)
+        __field(u16, addr)
+        __field(u64, period_ns)
+        __field(u64, wakeup_ns)
+        __field(u64, exec_ns)
+        __field(u64, e2e_ns)
+    ),
+    TP_fast_assign(
+        __entry->bus = client->adapter->nr;
+        __entry->addr = client->addr;
+        __entry->period_ns = period_ns;
+        __entry->wakeup_ns = wakeup_ns;
+        __entry->exec_ns = exec_ns;
+        __entry->e2e_ns = e2e_ns;
+    ),
+    TP_printk("%d-%04x period_ns=%llu wakeup_ns=%llu exec_ns=%llu e2e_ns=%llu",
+              __entry->bus, __entry->addr, __entry->period_ns, __entry->wakeup_ns,
+              __entry->exec_ns, __entry->e2e_ns)
+);
+
+#endif /* _BME280_TRACE_H */
+
+/* This part must be outside protection */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE bme280_trace
+#include <trace/define_trace.h>
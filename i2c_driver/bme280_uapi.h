@@ -0,0 +1,117 @@
+#include <linux/types.h>
+#ifndef BME280_UAPI_H
+#define BME280_UAPI_H
+/*
+ * Records shared with userspace. Usable from both the kernel and user programs
+ * (only needs linux/types.h). Multi-byte fields are in host byte order.
+ */
+
+/* One compensated sample: UDP payload and /dev/bme280 read() record */
+struct bme280_sensor_packet{ //packet structure for transmission
+    __u64 timestamp_ns;      // CLOCK_MONOTONIC
+    __s32 temp_c;            // 0.01 degC
+    __u32 humidity_percent;  // %RH
+    __u32 pressure_pa;       // Pa
+    __u16 crc;
+} __attribute__((packed));
+
+/*
+ * Aggregation mode (sysfs aggregate_window > 0): one summary per window of
+ * samples replaces the individual records on UDP and netlink. A UDP datagram
+ * holds either sensor packets or a single summary; summaries start with
+ * BME280_SUMMARY_MAGIC. Values keep the full compensated resolution: temp
+ * 0.01 degC, pressure Pa / 256, humidity %RH / 1024. stddev is the population
+ * standard deviation over the window.
+ */
+#define BME280_SUMMARY_MAGIC 0x4D555342 // "BSUM"
+
+struct bme280_channel_summary {
+    __s32 min;
+    __s32 max;
+    __s32 mean;
+    __u32 stddev;
+} __attribute__((packed));
+
+struct bme280_summary_packet {
+    __u32 magic;
+    __u32 count;       // samples in the window
+    __u64 first_ns;    // CLOCK_MONOTONIC of the first and last sample
+    __u64 last_ns;
+    struct bme280_channel_summary temp;
+    struct bme280_channel_summary pressure;
+    struct bme280_channel_summary humidity;
+} __attribute__((packed));
+
+/*
+ * mmap() of /dev/bme280 (offset 0, open O_RDWR, MAP_SHARED) maps a single-producer
+ * single-consumer ring: one header page followed by ring_slots slots of
+ * slot_size bytes at data_offset. The node is created read-only; the udev rule
+ * in 99-bme280.rules makes it writable by the bme280 group for mmap consumers.
+ *
+ * The kernel writes a slot, then publishes head with a release store. A consumer
+ * loads head with acquire, reads slots [tail, head) in place, then stores tail with
+ * release to hand them back. Indices are free running; slot i lives at
+ * data_offset + (i & (ring_slots - 1)) * slot_size. If the consumer falls
+ * ring_slots behind, new samples are dropped and counted in drops. The ring is
+ * only filled while mapped, and the first mapping starts with tail == head, so a
+ * new consumer sees only samples taken after its mmap(). Only one
+ * consumer may move tail.
+ *
+ *   head = __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE);
+ *   for (; tail != head; tail++)
+ *       use(&slots[tail & (hdr->ring_slots - 1)].pkt);
+ *   __atomic_store_n(&hdr->tail, tail, __ATOMIC_RELEASE);
+ */
+#define BME280_RING_MAGIC   0x42524E47 // "BRNG"
+#define BME280_RING_VERSION 1
+
+struct bme280_ring_hdr {
+    __u32 magic;
+    __u32 version;
+    __u32 ring_slots;  // power of two
+    __u32 slot_size;
+    __u64 data_offset;
+    __u64 drops;       // written by the kernel
+    __u8  pad0[32];
+    __u64 head;        // written by the kernel, own cache line
+    __u8  pad1[56];
+    __u64 tail;        // written by the consumer, own cache line
+    __u8  pad2[56];
+};
+
+struct bme280_ring_slot {
+    struct bme280_sensor_packet pkt;
+    __u8 pad[32 - sizeof(struct bme280_sensor_packet)];
+};
+
+/*
+ * Generic netlink family BME280_GENL_NAME. Resolve it (and the group id) through
+ * nlctrl, join BME280_GENL_MCGRP_SAMPLES, and receive one BME280_GENL_CMD_SAMPLES
+ * message per TX batch of every sensor, with:
+ *   BME280_GENL_ATTR_BUS      u32, I2C adapter number
+ *   BME280_GENL_ATTR_ADDR     u16, I2C address
+ *   BME280_GENL_ATTR_SAMPLES  array of struct bme280_sensor_packet
+ * In aggregation mode a BME280_GENL_CMD_SUMMARY message per window instead, with
+ * BUS, ADDR and BME280_GENL_ATTR_SUMMARY (struct bme280_summary_packet).
+ */
+#define BME280_GENL_NAME          "bme280"
+#define BME280_GENL_VERSION       1
+#define BME280_GENL_MCGRP_SAMPLES "samples"
+
+enum {
+    BME280_GENL_CMD_UNSPEC,
+    BME280_GENL_CMD_SAMPLES,
+    BME280_GENL_CMD_SUMMARY,
+};
+
+enum {
+    BME280_GENL_ATTR_UNSPEC,
+    BME280_GENL_ATTR_BUS,
+    BME280_GENL_ATTR_ADDR,
+    BME280_GENL_ATTR_SAMPLES,
+    BME280_GENL_ATTR_SUMMARY,
+    __BME280_GENL_ATTR_MAX,
+};
+#define BME280_GENL_ATTR_MAX (__BME280_GENL_ATTR_MAX - 1)
+
+#endif
@@ -2,20 +2,53 @@
 #include <linux/init.h>
 #include <linux/i2c.h>
 #include <linux/delay.h>
+#include <linux/iopoll.h>
+#include <linux/regmap.h>
 #include <linux/timekeeping.h>
 #include <linux/of_device.h>
 #include <linux/kthread.h>
+#include <linux/hrtimer.h>
+#include <linux/wait.h>
+#include <linux/mutex.h>
+#include <linux/seqlock.h>
 #include <linux/net.h>
 #include <linux/in.h>
 #include <linux/socket.h>
 #include <linux/inet.h>
 #include <net/sock.h>
 #include "adc_conversion.h"
+#include "bme280.h"
+#include "bme280_chardev.h"
+#include "bme280_iio.h"
+#include "bme280_stats.h"
+#include "bme280_genl.h"
+#include "bme280_pipeline.h"
 
-static struct task_struct *sensor_thread;
-static bool thread_run = true;
-static struct socket *udp_sock;
-static struct sockaddr_in udp_addr;
+#define CREATE_TRACE_POINTS
+#include "bme280_trace.h"
+
+#define BME280_REG_CALIB_TP 0x88 //dig_T1..dig_H1
+#define BME280_CALIB_TP_LEN 26
+#define BME280_REG_CHIP_ID  0xD0
+#define BME280_REG_RESET    0xE0
+#define BME280_REG_CALIB_H  0xE1 //dig_H2..dig_H6
+#define BME280_CALIB_H_LEN  7
+#define BME280_REG_CTRL_HUM  0xF2
+#define BME280_REG_STATUS    0xF3
+#define BME280_REG_CTRL_MEAS 0xF4
+#define BME280_REG_CONFIG    0xF5
+#define BME280_STATUS_IM_UPDATE 0x01
+#define BME280_STATUS_MEASURING 0x08
+#define BME280_MODE_SLEEP  0x00
+#define BME280_MODE_FORCED 0x01
+#define BME280_MODE_NORMAL 0x03
+#define BME280_REG_DATA 0xF7 //press_msb, first of the 8 byte data block
+#define BME280_DATA_LEN 8
+
+#define BME280_NVM_POLL_US    200
+#define BME280_NVM_TIMEOUT_US 10000
+#define BME280_MEASURE_POLL_US  100
+#define BME280_MEASURE_SLACK_US 1000 //past the datasheet max before giving up
 
 static char *dest_ip = "192.168.68.75";
 module_param(dest_ip, charp, 0644);
@@ -24,6 +57,56 @@ MODULE_PARM_DESC(dest_ip, "Destination IPv4 address for UDP packets");
 static int dest_port = 5005;
 module_param(dest_port, int, 0644);
 MODULE_PARM_DESC(dest_port, "Destination UDP port");
+
+static unsigned int period_us = 1000000;
+module_param(period_us, uint, 0444);
+MODULE_PARM_DESC(period_us, "Initial sampling period in microseconds (runtime: sample_period_us in sysfs)");
+
+static unsigned int udp_batch_count = 1;
+module_param(udp_batch_count, uint, 0444);
+MODULE_PARM_DESC(udp_batch_count, "Samples per UDP datagram, 1 disables batching (runtime: batch_count in sysfs)");
+
+static unsigned int udp_batch_timeout_us;
+module_param(udp_batch_timeout_us, uint, 0444);
+MODULE_PARM_DESC(udp_batch_timeout_us, "Max age of a queued sample before its datagram is sent, 0 = no limit (runtime: batch_timeout_us in sysfs)");
+
+static char *sampler_policy = "normal";
+module_param(sampler_policy, charp, 0444);
+MODULE_PARM_DESC(sampler_policy, "Policy of the per-adapter sampling worker: normal, fifo or deadline (runtime: sched/policy in sysfs)");
+
+static unsigned int sampler_fifo_prio = 50;
+module_param(sampler_fifo_prio, uint, 0444);
+MODULE_PARM_DESC(sampler_fifo_prio, "SCHED_FIFO priority, 1..99");
+
+static unsigned int sampler_dl_runtime_us = 2000;
+module_param(sampler_dl_runtime_us, uint, 0444);
+MODULE_PARM_DESC(sampler_dl_runtime_us, "SCHED_DEADLINE runtime in microseconds");
+
+static unsigned int sampler_dl_period_us = 10000;
+module_param(sampler_dl_period_us, uint, 0444);
+MODULE_PARM_DESC(sampler_dl_period_us, "SCHED_DEADLINE period (and relative deadline) in microseconds");
+
+static char *sampler_cpus;
+module_param(sampler_cpus, charp, 0444);
+MODULE_PARM_DESC(sampler_cpus, "CPU list the per-adapter sampling worker may run on, e.g. 3 or 2-3 (runtime: sched/cpus in sysfs)");
+
+static unsigned int decimate_factor = 1;
+module_param(decimate_factor, uint, 0444);
+MODULE_PARM_DESC(decimate_factor, "Samples per low-pass filtered output, 1 = off (runtime: decimate/factor in sysfs)");
+
+static unsigned int aggregate_window;
+module_param(aggregate_window, uint, 0444);
+MODULE_PARM_DESC(aggregate_window, "Samples per min/max/mean/stddev summary sent instead of raw samples, 0 = off (runtime: aggregate_window in sysfs)");
+
+//Off by default: with a single adapter, pinning only stops the scheduler from
+//moving the worker away from interrupt load
+static bool spread_workers;
+module_param(spread_workers, bool, 0444);
+MODULE_PARM_DESC(spread_workers, "Bind each I2C adapter's sampling worker to the least used housekeeping CPU (unless sampler_cpus is set or the policy is deadline)");
+
+static bool forced_mode;
+module_param(forced_mode, bool, 0444);
+MODULE_PARM_DESC(forced_mode, "Start in forced mode: one conversion per sample (runtime: mode in sysfs)");
 MODULE_LICENSE("GPL");
 
 struct my_data {
@@ -36,238 +119,672 @@ static struct my_data a = {
     42,
 };
 
-struct bme280_sensor_packet{ //packet structure for transmission
-    uint64_t timestamp_ns;
-    int32_t temp_c;
-    uint32_t humidity_percent;
-    uint32_t pressure_pa;
-    uint16_t crc;
-} __attribute__((packed));
-
 static struct i2c_device_id my_ids[] = {
     {"tyrunner_bme280", (long unsigned int) &a},
     {},
 };
 MODULE_DEVICE_TABLE(i2c, my_ids);
 
-static int16_t read_s16_data(struct i2c_client *client, int reg){
-    int lower = i2c_smbus_read_byte_data(client, reg);
-    int higher = i2c_smbus_read_byte_data(client, reg+1);
+static const struct regmap_range bme280_readable_ranges[] = {
+    regmap_reg_range(BME280_REG_CALIB_TP, BME280_REG_CALIB_TP + BME280_CALIB_TP_LEN - 1),
+    regmap_reg_range(BME280_REG_CHIP_ID, BME280_REG_CHIP_ID),
+    regmap_reg_range(BME280_REG_CALIB_H, BME280_REG_CALIB_H + BME280_CALIB_H_LEN - 1),
+    regmap_reg_range(BME280_REG_CTRL_HUM, BME280_REG_CONFIG),
+    regmap_reg_range(BME280_REG_DATA, BME280_REG_DATA + BME280_DATA_LEN - 1),
+};
 
-    return (int16_t)((higher << 8) | lower);
+static const struct regmap_range bme280_writeable_ranges[] = {
+    regmap_reg_range(BME280_REG_RESET, BME280_REG_RESET),
+    regmap_reg_range(BME280_REG_CTRL_HUM, BME280_REG_CTRL_HUM),
+    regmap_reg_range(BME280_REG_CTRL_MEAS, BME280_REG_CONFIG),
+};
+
+//Changed by the sensor itself: conversion status and results. Everything else
+//(chip id, config) is served from the cache after the first access.
+static const struct regmap_range bme280_volatile_ranges[] = {
+    regmap_reg_range(BME280_REG_STATUS, BME280_REG_STATUS),
+    regmap_reg_range(BME280_REG_DATA, BME280_REG_DATA + BME280_DATA_LEN - 1),
+};
+
+static const struct regmap_access_table bme280_readable_table = {
+    .yes_ranges = bme280_readable_ranges,
+    .n_yes_ranges = ARRAY_SIZE(bme280_readable_ranges),
+};
+
+static const struct regmap_access_table bme280_writeable_table = {
+    .yes_ranges = bme280_writeable_ranges,
+    .n_yes_ranges = ARRAY_SIZE(bme280_writeable_ranges),
+};
+
+static const struct regmap_access_table bme280_volatile_table = {
+    .yes_ranges = bme280_volatile_ranges,
+    .n_yes_ranges = ARRAY_SIZE(bme280_volatile_ranges),
+};
+
+//No precious table: no BME280 register has read side effects (nothing clears on read)
+static const struct regmap_config bme280_regmap_config = {
+    .reg_bits = 8,
+    .val_bits = 8,
+    .max_register = BME280_REG_DATA + BME280_DATA_LEN - 1,
+    .rd_table = &bme280_readable_table,
+    .wr_table = &bme280_writeable_table,
+    .volatile_table = &bme280_volatile_table,
+    .cache_type = REGCACHE_RBTREE,
+};
+
+static uint16_t le16_at(const uint8_t *buf){
+    return (uint16_t)(buf[0] | (buf[1] << 8));
 }
 
-static uint16_t read_u16_data(struct i2c_client *client, int reg){
-    int lower = i2c_smbus_read_byte_data(client, reg);
-    int higher = i2c_smbus_read_byte_data(client, reg+1);
+//Two block reads (0x88..0xA1 and 0xE1..0xE7) instead of ~40 single byte transactions.
+//regmap_bulk_read() splits cacheable ranges into one read per register whatever the
+//bypass setting; regmap_raw_read() does one transfer when the cache is bypassed.
+//bme->calib is the cached copy from then on.
+static int read_calibration_data(struct bme280_dev *bme){
+    struct bme280_calib_data *calib = &bme->calib;
+    uint8_t tp[BME280_CALIB_TP_LEN];
+    uint8_t h[BME280_CALIB_H_LEN];
+    int ret;
+
+    regcache_cache_bypass(bme->regmap, true);
+    ret = regmap_raw_read(bme->regmap, BME280_REG_CALIB_TP, tp, BME280_CALIB_TP_LEN);
+    if (!ret)
+        ret = regmap_raw_read(bme->regmap, BME280_REG_CALIB_H, h, BME280_CALIB_H_LEN);
+    regcache_cache_bypass(bme->regmap, false);
+    if (ret < 0)
+        return ret;
+
+    calib->dig_T1 = le16_at(&tp[0]);
+    calib->dig_T2 = (int16_t)le16_at(&tp[2]);
+    calib->dig_T3 = (int16_t)le16_at(&tp[4]);
 
-    return (uint16_t)((higher << 8) | lower);
+    calib->dig_P1 = le16_at(&tp[6]);
+    calib->dig_P2 = (int16_t)le16_at(&tp[8]);
+    calib->dig_P3 = (int16_t)le16_at(&tp[10]);
+    calib->dig_P4 = (int16_t)le16_at(&tp[12]);
+    calib->dig_P5 = (int16_t)le16_at(&tp[14]);
+    calib->dig_P6 = (int16_t)le16_at(&tp[16]);
+    calib->dig_P7 = (int16_t)le16_at(&tp[18]);
+    calib->dig_P8 = (int16_t)le16_at(&tp[20]);
+    calib->dig_P9 = (int16_t)le16_at(&tp[22]);
+
+    calib->dig_H1 = tp[25]; //0xA1, 0xA0 is unused
+    calib->dig_H2 = (int16_t)le16_at(&h[0]);
+    calib->dig_H3 = h[2];
+    //0xE5 is shared: low nibble belongs to H4, high nibble to H5. E4/E6 are signed.
+    calib->dig_H4 = (int16_t)(((int8_t)h[3] * 16) | (h[4] & 0x0F));
+    calib->dig_H5 = (int16_t)(((int8_t)h[5] * 16) | (h[4] >> 4));
+    calib->dig_H6 = (int8_t)h[6];
+    return 0;
 }
 
-static void read_calibration_data(struct i2c_client *client){
-    calib.dig_T1 = read_u16_data(client, 0x88);
-    calib.dig_T2 = read_s16_data(client, 0x8A);
-    calib.dig_T3 = read_s16_data(client, 0x8C);
+//The sensor copies its NVM trimming into the image registers after power up
+//or reset. Poll im_update instead of sleeping a fixed time.
+static int bme280_wait_nvm_copy(struct bme280_dev *bme){
+    unsigned int status;
 
-    calib.dig_P1 = read_u16_data(client, 0x8E);
-    calib.dig_P2 = read_u16_data(client, 0x90);
-    calib.dig_P3 = read_u16_data(client, 0x92);
-    calib.dig_P4 = read_u16_data(client, 0x94);
-    calib.dig_P5 = read_u16_data(client, 0x96);
-    calib.dig_P6 = read_u16_data(client, 0x98);
-    calib.dig_P7 = read_u16_data(client, 0x9A);
-    calib.dig_P8 = read_u16_data(client, 0x9C);
-    calib.dig_P9 = read_u16_data(client, 0x9E);
+    return regmap_read_poll_timeout(bme->regmap, BME280_REG_STATUS, status,
+                                    !(status & BME280_STATUS_IM_UPDATE),
+                                    BME280_NVM_POLL_US, BME280_NVM_TIMEOUT_US);
+}
 
-    calib.dig_H1 = i2c_smbus_read_byte_data(client, 0xA1);
-    calib.dig_H2 = read_s16_data(client, 0xE1);
-    calib.dig_H3 = i2c_smbus_read_byte_data(client, 0xE3);
-    calib.dig_H4 = (i2c_smbus_read_byte_data(client, 0xE4) << 4) | ((i2c_smbus_read_byte_data(client, 0xE5)) & 0x0F) ;
-    calib.dig_H5 = (i2c_smbus_read_byte_data(client, 0xE6) << 4) | ((i2c_smbus_read_byte_data(client, 0xE5) >> 4) & 0x0F) ;
-    calib.dig_H6 = (int8_t)i2c_smbus_read_byte_data(client, 0xE7);
+//osrs register code (0 = skipped, 1..5 = x1..x16) to oversampling factor
+static unsigned int bme280_osrs_factor(u8 code){
+    return code ? 1 << (min_t(u8, code, 5) - 1) : 0;
 }
 
+static u8 bme280_ctrl_meas(struct bme280_dev *bme, u8 mode){
+    return (bme->osrs_t << 5) | (bme->osrs_p << 2) | mode;
+}
 
-static int bme280_init(struct i2c_client *client){
-    if (i2c_smbus_write_byte_data(client, 0xF2, 0x01) < 0)
-        return -EIO;
-    if (i2c_smbus_write_byte_data(client, 0xF4, 0x27) < 0)
-        return -EIO;
-    return 0;
+//Accepted sysfs values, indexed by register code
+static const unsigned int bme280_osrs_values[] = { 0, 1, 2, 4, 8, 16 };
+static const unsigned int bme280_filter_values[] = { 0, 2, 4, 8, 16 };
+static const unsigned int bme280_t_sb_us_values[] = { 500, 62500, 125000, 250000, 500000, 1000000, 10000, 20000 };
+
+static int bme280_value_to_code(const unsigned int *values, size_t n, unsigned int val){
+    size_t i;
+
+    for (i = 0; i < n; i++)
+        if (values[i] == val)
+            return i;
+    return -EINVAL;
 }
 
-static int read_bit_data(uint8_t* buffer, struct i2c_client *client, int offset, int bytes){
-    int return_status = i2c_smbus_read_i2c_block_data(client, offset, bytes, buffer);
+//Normal mode runs the sensor's own conversion cycle; forced mode leaves it asleep
+//until bme280_read_compensated() triggers a conversion. Registers are compared
+//against the regmap cache, so only what changed goes on the bus. Called with
+//bme->lock held, or from probe before anything else can reach the device.
+static int bme280_init(struct bme280_dev *bme){
+    struct regmap *map = bme->regmap;
+    u8 mode = bme->forced ? BME280_MODE_SLEEP : BME280_MODE_NORMAL;
+    unsigned int config = (bme->t_sb << 5) | (bme->filter << 2);
+    unsigned int cur;
+    bool rewrite_meas = false;
+    bool hum_changed;
+    int ret;
 
-    if(return_status < 0){
-        return return_status;
+    //a pending bme280_trigger() conversion used the old settings
+    bme->triggered = false;
+    ret = regmap_read(map, BME280_REG_CONFIG, &cur);
+    if (ret)
+        return ret;
+    //config writes are only guaranteed to land in sleep mode
+    if (cur != config) {
+        ret = regmap_write(map, BME280_REG_CTRL_MEAS, bme280_ctrl_meas(bme, BME280_MODE_SLEEP));
+        if (!ret)
+            ret = regmap_write(map, BME280_REG_CONFIG, config);
+        if (ret)
+            return ret;
+        rewrite_meas = true;
     }
-    return 0;
+    //ctrl_hum only latches on the following ctrl_meas write
+    ret = regmap_update_bits_check(map, BME280_REG_CTRL_HUM, 0xFF, bme->osrs_h, &hum_changed);
+    if (ret)
+        return ret;
+    if (rewrite_meas || hum_changed)
+        return regmap_write(map, BME280_REG_CTRL_MEAS, bme280_ctrl_meas(bme, mode));
+    return regmap_update_bits(map, BME280_REG_CTRL_MEAS, 0xFF, bme280_ctrl_meas(bme, mode));
 }
 
-//Grouped data read
-static void bme280_read_all(struct i2c_client *client, int32_t* temp_c, uint32_t* press_pa, uint32_t* humid_rh, struct timespec64 *ts){
-    //ktime_get_real_ts64(ts); wall clock, used fro data logging and sensors
-    ktime_get_ts64(ts); //monotonic, kernel
-    uint8_t buf[3];
-
-    //printk(KERN_INFO
-    //       "[%lld.%09ld] Timestamp and Read data code: %d\n",
-    //       (long long)ts->tv_sec,
-    //       ts->tv_nsec,
-    //       read_bit_data(buf, client, 0xFA, 3));
-
-    if (read_bit_data(buf, client, 0xFA, 3) == 0) { // temp
-        int32_t temp_raw = (buf[0] << 12) | (buf[1] << 4) | (buf[2] >> 4);
-        *temp_c = compensate_temp(temp_raw);
-        printk(KERN_INFO
-               "[%lld.%09ld] Temp: %d.%02d C\n",
-               (long long)ts->tv_sec,
-               ts->tv_nsec,
-               *temp_c / 100,
-               *temp_c % 100);
-    }
+//Datasheet max measurement time (section 9.1) for the given oversampling factors,
+//0 meaning the channel is skipped.
+static unsigned int bme280_measure_time_us(unsigned int osrs_t, unsigned int osrs_p, unsigned int osrs_h){
+    unsigned int t = 1250 + 2300 * osrs_t;
+
+    if (osrs_p)
+        t += 2300 * osrs_p + 575;
+    if (osrs_h)
+        t += 2300 * osrs_h + 575;
+    return t;
+}
+
+//Datasheet typical measurement time, same formula with the typical constants
+static unsigned int bme280_typ_measure_time_us(unsigned int osrs_t, unsigned int osrs_p, unsigned int osrs_h){
+    unsigned int t = 1000 + 2000 * osrs_t;
+
+    if (osrs_p)
+        t += 2000 * osrs_p + 500;
+    if (osrs_h)
+        t += 2000 * osrs_h + 500;
+    return t;
+}
+
+static unsigned int bme280_t_measure_us(struct bme280_dev *bme){
+    return bme280_measure_time_us(bme280_osrs_factor(bme->osrs_t),
+                                  bme280_osrs_factor(bme->osrs_p),
+                                  bme280_osrs_factor(bme->osrs_h));
+}
+
+//Shortest period the sensor can deliver fresh data at with the current config.
+//Normal mode converts once per t_measure + t_standby.
+static unsigned int bme280_min_period_us(struct bme280_dev *bme){
+    unsigned int t = bme280_t_measure_us(bme);
+
+    if (!bme->forced)
+        t += bme280_t_sb_us_values[bme->t_sb];
+    return t;
+}
+
+//I2C bytes on the wire per sample, address bytes included, status polls excluded.
+//The measured bus time is in debugfs (i2c histogram).
+static unsigned int bme280_bus_bytes_per_sample(struct bme280_dev *bme){
+    unsigned int bytes = 3 + BME280_DATA_LEN; //addr+W, reg, addr+R, data
+
+    if (bme->forced)
+        bytes += 3 + 4; //ctrl_meas write, one status read
+    return bytes;
+}
+
+//Forced mode: start one conversion (unless bme280_trigger() already did), sleep
+//through what is left of the typical conversion time and poll the measuring bit
+//for the rest, so the data registers are read as soon as they hold the new
+//result. Called with bme->lock held.
+static int bme280_force_measurement(struct bme280_dev *bme){
+    unsigned int typ = bme280_typ_measure_time_us(bme280_osrs_factor(bme->osrs_t),
+                                                  bme280_osrs_factor(bme->osrs_p),
+                                                  bme280_osrs_factor(bme->osrs_h));
+    u64 elapsed_us = 0;
+    unsigned int status;
+    int ret;
 
-    if (read_bit_data(buf, client, 0xF7, 3) == 0) { // pressure
-        int32_t press_raw = (buf[0] << 12) | (buf[1] << 4) | (buf[2] >> 4);
-        *press_pa = compensate_pressure(press_raw) >> 8;
+    if (bme->triggered) {
+        bme->triggered = false;
+        elapsed_us = div_u64(ktime_get_ns() - bme->triggered_ns, NSEC_PER_USEC);
+    } else {
+        //always written: the sensor drops back to sleep by itself, the cache does not know
+        ret = regmap_write(bme->regmap, BME280_REG_CTRL_MEAS, bme280_ctrl_meas(bme, BME280_MODE_FORCED));
+        if (ret < 0)
+            return ret;
+    }
+    if (elapsed_us < typ)
+        fsleep(typ - elapsed_us);
+    return regmap_read_poll_timeout(bme->regmap, BME280_REG_STATUS, status,
+                                    !(status & BME280_STATUS_MEASURING),
+                                    BME280_MEASURE_POLL_US,
+                                    bme280_t_measure_us(bme) - typ + BME280_MEASURE_SLACK_US);
+}
 
-        printk(KERN_INFO
-               "[%lld.%09ld] Pressure: %u Pa\n",
-               (long long)ts->tv_sec,
-               ts->tv_nsec,
-               *press_pa);
+//Starts a forced conversion now and leaves the rest to the next
+//bme280_read_compensated(). Lets the bus worker have every due sensor converting
+//at once instead of one after another.
+void bme280_trigger(struct bme280_dev *bme){
+    mutex_lock(&bme->lock);
+    if (bme->forced && !bme->triggered &&
+        !regmap_write(bme->regmap, BME280_REG_CTRL_MEAS, bme280_ctrl_meas(bme, BME280_MODE_FORCED))) {
+        bme->triggered = true;
+        bme->triggered_ns = ktime_get_ns();
     }
+    mutex_unlock(&bme->lock);
+}
+
+//Rewrites the sensor config after a field changed and raises the sampling period
+//if it is now shorter than a fresh sample takes. Called with bme->lock held.
+static int bme280_apply_config(struct bme280_dev *bme){
+    int ret = bme280_init(bme);
+
+    if (!ret && READ_ONCE(bme->period_us) < bme280_min_period_us(bme))
+        WRITE_ONCE(bme->period_us, bme280_min_period_us(bme));
+    return ret;
+}
+
+//Sets one register code field, rolling it back if the sensor did not take it
+static int bme280_update_config(struct bme280_dev *bme, u8 *field, u8 code){
+    u8 old;
+    int ret;
 
-    if (read_bit_data(buf, client, 0xFD, 2) == 0) { // humidity
-        int32_t humid_raw = (buf[0] << 8) | buf[1];
-        *humid_rh = compensate_humidity(humid_raw) / 1024;
+    mutex_lock(&bme->lock);
+    old = *field;
+    *field = code;
+    ret = bme280_apply_config(bme);
+    if (ret)
+        *field = old;
+    mutex_unlock(&bme->lock);
+    return ret;
+}
+
+//Grouped data read
+//One burst over 0xF7..0xFE (press[3], temp[3], hum[2]). The sensor only guarantees
+//the shadow registers belong to a single conversion within one burst, and it costs
+//one I2C transaction per sample instead of three.
+//Outputs full resolution: temp 0.01 C, pressure Pa * 256, humidity %RH * 1024.
+int bme280_read_compensated(struct bme280_dev *bme, int32_t *temp_c, uint32_t *press_q8, uint32_t *humid_q10, uint64_t *bus_ns){
+    uint8_t buf[BME280_DATA_LEN];
+    int ret;
 
-        printk(KERN_INFO
-               "[%lld.%09ld] Humidity: %u %%\n",
-               (long long)ts->tv_sec,
-               ts->tv_nsec,
-               *humid_rh);
+    //the IIO trigger, sysfs and the thread all read; t_fine is shared by the three compensations
+    mutex_lock(&bme->lock);
+    if (bme->forced) {
+        ret = bme280_force_measurement(bme);
+        if (ret < 0) {
+            mutex_unlock(&bme->lock);
+            dev_err(&bme->client->dev, "BME280 forced measurement failed: %d\n", ret);
+            return ret;
+        }
+    }
+    uint64_t bus_start = ktime_get_ns();
+    //volatile range, so a single raw transfer
+    ret = regmap_bulk_read(bme->regmap, BME280_REG_DATA, buf, BME280_DATA_LEN);
+    uint64_t bus_end = ktime_get_ns();
+    if (bus_ns)
+        *bus_ns = bus_end - bus_start;
+    if (ret < 0) {
+        mutex_unlock(&bme->lock);
+        dev_err(&bme->client->dev, "BME280 data read failed: %d\n", ret);
+        return ret;
     }
+
+    int32_t press_raw = (buf[0] << 12) | (buf[1] << 4) | (buf[2] >> 4);
+    int32_t temp_raw = (buf[3] << 12) | (buf[4] << 4) | (buf[5] >> 4);
+    int32_t humid_raw = (buf[6] << 8) | buf[7];
+
+    // temp first: it updates t_fine, which pressure and humidity depend on
+    *temp_c = compensate_temp(bme, temp_raw);
+    *press_q8 = compensate_pressure(bme, press_raw);
+    *humid_q10 = compensate_humidity(bme, humid_raw);
+    mutex_unlock(&bme->lock);
+
+    trace_bme280_sample_read(bme->client, temp_raw, press_raw, humid_raw, bus_end - bus_start);
+    trace_bme280_compensate(bme->client, *temp_c, *press_q8, *humid_q10);
+    return 0;
+}
+
+//Timestamped full-resolution reading; fill_data_packet() scales it down for the wire
+static int bme280_read_all(struct bme280_dev *bme, struct bme280_reading *r, uint64_t *bus_ns){
+    int32_t temp_c;
+    uint32_t press_q8, humid_q10;
+
+    //ktime_get_real_ns(); wall clock, used fro data logging and sensors
+    r->timestamp_ns = ktime_get_ns(); //monotonic, kernel
+
+    int ret = bme280_read_compensated(bme, &temp_c, &press_q8, &humid_q10, bus_ns);
+    if (ret < 0)
+        return ret;
+
+    r->val[BME280_CH_TEMP] = temp_c;
+    r->val[BME280_CH_PRESS] = press_q8;
+    r->val[BME280_CH_HUMID] = humid_q10;
+    return 0;
 }
 
-static int udp_init_socket(void)
+static int udp_init_socket(struct bme280_dev *bme)
 {
     int ret;
 
-    if (udp_sock)
+    if (bme->udp_sock)
         return 0;
 
-    ret = sock_create_kern(&init_net, AF_INET, SOCK_DGRAM, IPPROTO_UDP, &udp_sock);
+    ret = sock_create_kern(&init_net, AF_INET, SOCK_DGRAM, IPPROTO_UDP, &bme->udp_sock);
     if (ret < 0) {
         pr_err("UDP: sock_create_kern failed: %d\n", ret);
-        udp_sock = NULL;
+        bme->udp_sock = NULL;
         return ret;
     }
 
-    memset(&udp_addr, 0, sizeof(udp_addr));
-    udp_addr.sin_family = AF_INET;
-    udp_addr.sin_port = htons((u16)dest_port);
+    memset(&bme->udp_addr, 0, sizeof(bme->udp_addr));
+    bme->udp_addr.sin_family = AF_INET;
+    bme->udp_addr.sin_port = htons((u16)dest_port);
 
-    ret = in4_pton(dest_ip, -1, (u8 *)&udp_addr.sin_addr.s_addr, -1, NULL);
+    ret = in4_pton(dest_ip, -1, (u8 *)&bme->udp_addr.sin_addr.s_addr, -1, NULL);
     if (ret == 0) {
         pr_err("UDP: invalid dest_ip: %s\n", dest_ip);
-        sock_release(udp_sock);
-        udp_sock = NULL;
+        sock_release(bme->udp_sock);
+        bme->udp_sock = NULL;
         return -EINVAL;
     }
 
-    pr_info("UDP: sending to %s:%d\n", dest_ip, dest_port);
+    pr_info("UDP: %s sending to %s:%d\n", dev_name(&bme->client->dev), dest_ip, dest_port);
     return 0;
 }
 
-static void udp_close_socket(void)
+static void udp_close_socket(struct bme280_dev *bme)
 {
-    if (udp_sock) {
-        sock_release(udp_sock);
-        udp_sock = NULL;
+    if (bme->udp_sock) {
+        sock_release(bme->udp_sock);
+        bme->udp_sock = NULL;
     }
 }
 
-static void send_data_packet(uint64_t timestamp_ns, int32_t temp_c, uint32_t press_pa, uint32_t humid_rh){
-    struct bme280_sensor_packet pkt;
-    struct msghdr msg;
-    struct kvec vec;
+static void fill_data_packet(struct bme280_sensor_packet *pkt, const struct bme280_reading *r){
+    pkt->timestamp_ns = r->timestamp_ns;
+    pkt->temp_c = r->val[BME280_CH_TEMP];
+    pkt->pressure_pa = (uint32_t)r->val[BME280_CH_PRESS] >> 8;
+    pkt->humidity_percent = (uint32_t)r->val[BME280_CH_HUMID] / 1024;
+    pkt->crc = 0; //TODO
+}
 
-    if(!udp_sock)
-        return;
-    pkt.timestamp_ns = timestamp_ns;
-    pkt.temp_c = temp_c;
-    pkt.pressure_pa = press_pa;
-    pkt.humidity_percent = humid_rh;
-    pkt.crc = 0; //TODO
+//Sends the first n records of the TX scratch batch as one datagram, one kvec per record
+static void udp_send_batch(struct bme280_dev *bme, unsigned int n){
+    struct msghdr msg = {};
+    struct kvec vec[BME280_UDP_BATCH_MAX];
+    size_t len = n * sizeof(bme->batch[0]);
+    unsigned int i;
 
-    msg.msg_name = &udp_addr;
-    msg.msg_namelen = sizeof(udp_addr);
+    msg.msg_name = &bme->udp_addr;
+    msg.msg_namelen = sizeof(bme->udp_addr);
+    msg.msg_flags = MSG_DONTWAIT; //a full socket buffer is a dropped datagram, not a stall
 
-    vec.iov_base = &pkt;
-    vec.iov_len = sizeof(pkt);
+    for (i = 0; i < n; i++) {
+        vec[i].iov_base = &bme->batch[i];
+        vec[i].iov_len = sizeof(bme->batch[i]);
+    }
     //transmit formed packet to given endpoint
-    int ret = kernel_sendmsg(udp_sock, &msg, &vec, 1, sizeof(pkt));
+    uint64_t send_start = ktime_get_ns();
+    int ret = kernel_sendmsg(bme->udp_sock, &msg, vec, n, len);
+    uint64_t send_ns = ktime_get_ns() - send_start;
+    trace_bme280_send(bme->client, len, ret, send_ns);
+    bme280_stats_record(bme->stats, BME280_HIST_SEND, send_ns);
     if (ret < 0) {
+        atomic64_add(n, &bme->tx_errors);
         pr_debug("UDP send failed: %d\n", ret);
-    } else if (ret != sizeof(pkt)) {
-        pr_debug("UDP partial send: %d/%zu\n", ret, sizeof(pkt));
+    } else if (ret != len) {
+        pr_debug("UDP partial send: %d/%zu\n", ret, len);
     }
 }
-static int sensor_thread_fn(void* client_ptr){
-    struct timespec64 ts;
-    struct i2c_client *client = client_ptr;
-    int32_t temp_c;
-    uint32_t press_pa;
-    uint32_t humid_rh;
-    uint64_t timestamp_ns;
 
-    // ---- METRICS ----
-    uint64_t prev_loop_start = 0;
+//One summary per datagram; they are rare enough that batching buys nothing
+static void udp_send_summary(struct bme280_dev *bme, struct bme280_summary_packet *sum){
+    struct msghdr msg = {};
+    struct kvec vec = { .iov_base = sum, .iov_len = sizeof(*sum) };
 
-    while(!kthread_should_stop()){
+    msg.msg_name = &bme->udp_addr;
+    msg.msg_namelen = sizeof(bme->udp_addr);
+    msg.msg_flags = MSG_DONTWAIT;
 
-        // ---- LOOP START ----
-        uint64_t loop_start = ktime_get_ns();
+    uint64_t send_start = ktime_get_ns();
+    int ret = kernel_sendmsg(bme->udp_sock, &msg, &vec, 1, sizeof(*sum));
+    uint64_t send_ns = ktime_get_ns() - send_start;
+    trace_bme280_send(bme->client, sizeof(*sum), ret, send_ns);
+    bme280_stats_record(bme->stats, BME280_HIST_SEND, send_ns);
+    if (ret < 0) {
+        atomic64_inc(&bme->tx_errors);
+        pr_debug("UDP summary send failed: %d\n", ret);
+    }
+}
 
-        // ---- JITTER (LOOP PERIOD) ----
-        if (prev_loop_start != 0) {
-            uint64_t loop_period = loop_start - prev_loop_start;
-            pr_info("METRIC: Loop Period (Jitter): %llu us\n", loop_period / 1000);
-        }
-        prev_loop_start = loop_start;
+//TX thread only
+static void send_summaries(struct bme280_dev *bme){
+    struct bme280_summary_packet sum;
 
-        // ---- END-TO-END LATENCY START ----
-        uint64_t e2e_start = ktime_get_ns();
+    unsigned int sinks = bme280_pipeline_net_sinks(bme);
 
-        // ---- SENSOR READ ----
-        bme280_read_all(client, &temp_c, &press_pa, &humid_rh, &ts);
+    while (kfifo_get(&bme->summary_fifo, &sum)) {
+        if (bme->udp_sock && (sinks & BME280_SINK_UDP))
+            udp_send_summary(bme, &sum);
+        if (sinks & BME280_SINK_NETLINK)
+            bme280_genl_send_summary(bme->client, &sum);
+    }
+}
 
-        pr_info("THREAD READ -> Temp: %d.%02d C | Pressure: %u Pa | Humidity: %u %%\n",
-                temp_c / 100,
-                abs(temp_c % 100),
-                press_pa,
-                humid_rh);
+//Takes up to max records off the TX queue and hands them to every network sink.
+//TX thread only.
+static void send_data_batch(struct bme280_dev *bme, unsigned int max){
+    unsigned int n = kfifo_out(&bme->tx_fifo, bme->batch, min_t(unsigned int, max, BME280_UDP_BATCH_MAX));
+    unsigned int sinks;
 
-        // ---- TIMESTAMP + SEND ----
-        timestamp_ns = (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+    if (!n)
+        return;
+    //the pipeline in force when the batch goes out, which may be newer than
+    //the one that queued it
+    sinks = bme280_pipeline_net_sinks(bme);
+    if (bme->udp_sock && (sinks & BME280_SINK_UDP))
+        udp_send_batch(bme, n);
+    if (sinks & BME280_SINK_NETLINK)
+        bme280_genl_send(bme->client, bme->batch, n);
+}
 
-        send_data_packet(timestamp_ns, temp_c, press_pa, humid_rh);
+//When the oldest queued record must go out, 0 if there is no time limit or nothing
+//queued. Record timestamps are CLOCK_MONOTONIC, same as ktime_get_ns().
+static u64 send_batch_deadline_ns(struct bme280_dev *bme){
+    unsigned int timeout_us = READ_ONCE(bme->batch_timeout_us);
+    struct bme280_sensor_packet oldest;
+
+    if (!timeout_us || !kfifo_peek(&bme->tx_fifo, &oldest))
+        return 0;
+    return oldest.timestamp_ns + (u64)timeout_us * NSEC_PER_USEC;
+}
 
-        // ---- END-TO-END LATENCY END ----
-        uint64_t e2e_end = ktime_get_ns();
-        pr_info("METRIC: E2E Latency: %llu us\n", (e2e_end - e2e_start) / 1000);
+//A full batch is queued, or the oldest record has waited long enough
+static bool send_batch_due(struct bme280_dev *bme){
+    unsigned int len = kfifo_len(&bme->tx_fifo);
+    u64 deadline;
 
-        // ---- LOOP EXECUTION TIME ----
-        uint64_t loop_end = ktime_get_ns();
-        pr_info("METRIC: Loop Exec Time: %llu us\n", (loop_end - loop_start) / 1000);
+    if (!len)
+        return false;
+    if (len >= READ_ONCE(bme->batch_count))
+        return true;
+    deadline = send_batch_deadline_ns(bme);
+    return deadline && ktime_get_ns() >= deadline;
+}
 
-        msleep(1000);
+//Sampler side: never blocks. kfifo is lock-free with one producer (the sampler)
+//and one consumer (the TX thread). The TX thread is only woken when it has
+//something to do: a full batch, or a first record whose timeout it must arm.
+static void send_data_packet(struct bme280_dev *bme, const struct bme280_sensor_packet *pkt){
+    unsigned int len;
+
+    if (!bme->tx_thread)
+        return;
+    if (!kfifo_put(&bme->tx_fifo, *pkt)) {
+        atomic64_inc(&bme->tx_drops);
+        return;
+    }
+    len = kfifo_len(&bme->tx_fifo);
+    if (len >= READ_ONCE(bme->batch_count) || (len == 1 && READ_ONCE(bme->batch_timeout_us)))
+        wake_up_interruptible(&bme->tx_wq);
+}
+
+//Sampler side of the aggregation mode: adds the reading to the window and queues
+//a summary once the window is full. Returns false when aggregation is off.
+static bool aggregate_sample(struct bme280_dev *bme, const struct bme280_reading *r){
+    unsigned int window = READ_ONCE(bme->agg_window);
+    struct bme280_summary_packet sum;
+
+    if (!window) {
+        //a window left over from before aggregation was switched off
+        bme280_agg_reset(&bme->agg);
+        return false;
+    }
+    if (!bme->tx_thread)
+        return true;
+    bme280_agg_add(&bme->agg, r);
+    if (bme->agg.n < window)
+        return true;
+    bme280_agg_summary(&bme->agg, &sum);
+    bme280_agg_reset(&bme->agg);
+    if (!kfifo_put(&bme->summary_fifo, sum))
+        atomic64_inc(&bme->tx_drops);
+    else
+        wake_up_interruptible(&bme->tx_wq);
+    return true;
+}
+
+//Owns the socket send, so a stall in kernel_sendmsg() (route lookup, neighbour
+//resolution) delays only this thread and never the sampling deadlines.
+static int tx_thread_fn(void *bme_ptr){
+    struct bme280_dev *bme = bme_ptr;
+
+    while (!kthread_should_stop()) {
+        u64 flush_at = send_batch_deadline_ns(bme);
+
+        if (flush_at) {
+            s64 left = flush_at - ktime_get_ns();
+            if (left > 0)
+                wait_event_interruptible_hrtimeout(bme->tx_wq,
+                                                   send_batch_due(bme) || !kfifo_is_empty(&bme->summary_fifo) ||
+                                                   kthread_should_stop(),
+                                                   ns_to_ktime(left));
+        } else {
+            wait_event_interruptible(bme->tx_wq,
+                                     send_batch_due(bme) || send_batch_deadline_ns(bme) ||
+                                     !kfifo_is_empty(&bme->summary_fifo) || kthread_should_stop());
+        }
+        send_summaries(bme);
+        while (send_batch_due(bme))
+            send_data_batch(bme, READ_ONCE(bme->batch_count));
     }
 
+    //module remove or device unbind: the sampler is already stopped, send what is left
+    while (!kfifo_is_empty(&bme->tx_fifo))
+        send_data_batch(bme, BME280_UDP_BATCH_MAX);
+    send_summaries(bme);
     return 0;
 }
+
+static void publish_latest(struct bme280_dev *bme, const struct bme280_sensor_packet *pkt){
+    write_seqlock(&bme->latest_lock);
+    bme->latest = *pkt;
+    bme->latest_valid = true;
+    write_sequnlock(&bme->latest_lock);
+}
+
+//Runs the sensor's configfs pipeline (bme280_pipeline.c) on one reading. A stage
+//that drops the sample ends the run. udp and netlink share the TX queue, so the
+//packet is queued once for both.
+static void run_pipeline(struct bme280_dev *bme, struct bme280_reading *r){
+    struct bme280_sensor_packet pkt;
+    struct bme280_pipeline pipe;
+    bool queued = false;
+    unsigned int i;
+
+    bme280_pipeline_get(bme, &pipe);
+    for (i = 0; i < pipe.nstages; i++) {
+        switch (pipe.stages[i]) {
+        case BME280_STAGE_FILTER:
+            bme280_filter_step(&bme->chan_filter, r);
+            break;
+        case BME280_STAGE_DECIMATE:
+            if (!bme280_decim_step(&bme->decim, r))
+                return;
+            break;
+        case BME280_STAGE_AGGREGATE:
+            if (aggregate_sample(bme, r))
+                return;
+            break;
+        case BME280_STAGE_DEADBAND:
+            if (!bme280_deadband_pass(&bme->deadband, r))
+                return;
+            break;
+        case BME280_STAGE_PACKET:
+            fill_data_packet(&pkt, r);
+            publish_latest(bme, &pkt);
+            break;
+        case BME280_STAGE_CHARDEV:
+            bme280_cdev_push(bme->cdev, &pkt);
+            break;
+        case BME280_STAGE_UDP:
+        case BME280_STAGE_NETLINK:
+            if (!queued)
+                send_data_packet(bme, &pkt);
+            queued = true;
+            break;
+        }
+    }
+}
+
+//One sample for the adapter's worker (bme280_bus.c), called when the sensor's
+//deadline_ns has passed. timer_late_ns is the hrtimer latency of the pass, or
+//negative if the pass was not started by the timer.
+void bme280_sample(struct bme280_dev *bme, u64 deadline_ns, s64 timer_late_ns){
+    struct bme280_reading r;
+    uint64_t bus_ns;
+
+    // ---- LOOP START ----
+    uint64_t loop_start = ktime_get_ns();
+
+    if (timer_late_ns >= 0)
+        bme280_stats_record(bme->stats, BME280_HIST_TIMER, timer_late_ns);
+
+    // ---- WAKEUP LATENCY (intended deadline to running, including sensors served before it) ----
+    uint64_t wakeup_ns = loop_start - deadline_ns;
+
+    // ---- JITTER (LOOP PERIOD) ----
+    uint64_t loop_period = bme->prev_loop_start ? loop_start - bme->prev_loop_start : 0;
+    bme->prev_loop_start = loop_start;
+
+    // ---- END-TO-END LATENCY START ----
+    uint64_t e2e_start = ktime_get_ns();
+
+    // ---- SENSOR READ ----
+    if (bme280_read_all(bme, &r, &bus_ns) < 0)
+        return;
+
+    // ---- PIPELINE ----
+    run_pipeline(bme, &r);
+
+    // ---- END-TO-END LATENCY END ----
+    uint64_t e2e_end = ktime_get_ns();
+
+    // ---- LOOP EXECUTION TIME ----
+    uint64_t loop_end = ktime_get_ns();
+    trace_bme280_loop(bme->client, loop_period, wakeup_ns, loop_end - loop_start, e2e_end - e2e_start);
+    if (loop_period)
+        bme280_stats_record(bme->stats, BME280_HIST_PERIOD, loop_period);
+    bme280_stats_record(bme->stats, BME280_HIST_WAKEUP, wakeup_ns);
+    bme280_stats_record(bme->stats, BME280_HIST_I2C, bus_ns);
+    bme280_stats_record(bme->stats, BME280_HIST_E2E, e2e_end - e2e_start);
+    bme280_stats_record(bme->stats, BME280_HIST_EXEC, loop_end - loop_start);
+}
 /*static int sensor_thread_fn(void* client_ptr){
     struct timespec64 ts;
     struct i2c_client *client = client_ptr;
@@ -292,35 +809,415 @@ static int sensor_thread_fn(void* client_ptr){
 
     return 0;
 }*/
+static ssize_t format_sample(char *buf, int32_t temp_c, uint32_t press_pa, uint32_t humid_rh){
+    return sprintf(buf,
+        "Temp: %s%d.%02d C\nPressure: %u Pa\nHumidity: %u %%\n",
+        temp_c < 0 ? "-" : "", abs(temp_c / 100), abs(temp_c % 100),
+        press_pa,
+        humid_rh);
+}
+
 //Exposing the data to the userspace in the device tree
+//Returns the sampler's latest sample; never touches the bus.
 static ssize_t read_sensor_show(struct device *dev,
                                 struct device_attribute *attr,
                                 char *buf)
 {
-    struct timespec64 ts;
-    struct i2c_client *client = to_i2c_client(dev);
-    int32_t temp_c;
-    uint32_t press_pa;
-    uint32_t humid_rh;
-    bme280_read_all(client, &temp_c, &press_pa, &humid_rh, &ts);
-    return sprintf(buf,
-        "Temp: %d.%02d C\nPressure: %u Pa\nHumidity: %u %%\n",
-        temp_c / 100, temp_c % 100,
-        press_pa,
-        humid_rh);
+    struct bme280_dev *bme = dev_get_drvdata(dev);
+    struct bme280_sensor_packet pkt;
+    bool valid;
+    unsigned int seq;
+
+    do {
+        seq = read_seqbegin(&bme->latest_lock);
+        pkt = bme->latest;
+        valid = bme->latest_valid;
+    } while (read_seqretry(&bme->latest_lock, seq));
 
+    if (!valid)
+        return -ENODATA;
+    return format_sample(buf, pkt.temp_c, pkt.pressure_pa, pkt.humidity_percent);
 }
 
 static DEVICE_ATTR_RO(read_sensor);
 
+//Opt-in forced read: one bus transaction per cat
+static ssize_t read_sensor_fresh_show(struct device *dev,
+                                      struct device_attribute *attr,
+                                      char *buf)
+{
+    struct bme280_dev *bme = dev_get_drvdata(dev);
+    struct bme280_sensor_packet pkt;
+    struct bme280_reading r;
+    int ret = bme280_read_all(bme, &r, NULL);
+    if (ret < 0)
+        return ret;
+    fill_data_packet(&pkt, &r);
+    return format_sample(buf, pkt.temp_c, pkt.pressure_pa, pkt.humidity_percent);
+}
+
+static DEVICE_ATTR_RO(read_sensor_fresh);
+
+static ssize_t probe_time_us_show(struct device *dev,
+                                  struct device_attribute *attr,
+                                  char *buf)
+{
+    struct bme280_dev *bme = dev_get_drvdata(dev);
+
+    return sprintf(buf, "%llu\n", bme->probe_time_ns / 1000);
+}
+
+static DEVICE_ATTR_RO(probe_time_us);
+
+static ssize_t sample_period_us_show(struct device *dev,
+                                     struct device_attribute *attr,
+                                     char *buf)
+{
+    struct bme280_dev *bme = dev_get_drvdata(dev);
+
+    return sprintf(buf, "%u\n", READ_ONCE(bme->period_us));
+}
+
+//Takes effect from the next deadline; the bus worker reads the period when it requeues.
+//Checked and set under bme->lock, so a concurrent osrs/t_sb/mode change either sees
+//the new period (and raises it if needed) or is seen by the check.
+static ssize_t sample_period_us_store(struct device *dev,
+                                      struct device_attribute *attr,
+                                      const char *buf, size_t count)
+{
+    struct bme280_dev *bme = dev_get_drvdata(dev);
+    unsigned int val;
+    int ret = kstrtouint(buf, 0, &val);
+
+    if (ret)
+        return ret;
+    mutex_lock(&bme->lock);
+    if (val < bme280_min_period_us(bme))
+        ret = -EINVAL;
+    else
+        WRITE_ONCE(bme->period_us, val);
+    mutex_unlock(&bme->lock);
+    return ret ? ret : count;
+}
+
+static DEVICE_ATTR_RW(sample_period_us);
+
+static ssize_t overruns_show(struct device *dev,
+                             struct device_attribute *attr,
+                             char *buf)
+{
+    struct bme280_dev *bme = dev_get_drvdata(dev);
+
+    return sprintf(buf, "%lld\n", atomic64_read(&bme->overruns));
+}
+
+static DEVICE_ATTR_RO(overruns);
+
+static ssize_t mode_show(struct device *dev,
+                         struct device_attribute *attr,
+                         char *buf)
+{
+    struct bme280_dev *bme = dev_get_drvdata(dev);
+
+    return sprintf(buf, "%s\n", READ_ONCE(bme->forced) ? "forced" : "normal");
+}
+
+//"forced": one conversion per sample, sensor asleep in between. "normal": sensor free-runs.
+static ssize_t mode_store(struct device *dev,
+                          struct device_attribute *attr,
+                          const char *buf, size_t count)
+{
+    struct bme280_dev *bme = dev_get_drvdata(dev);
+    bool forced;
+    int ret;
+
+    if (sysfs_streq(buf, "forced"))
+        forced = true;
+    else if (sysfs_streq(buf, "normal"))
+        forced = false;
+    else
+        return -EINVAL;
+
+    mutex_lock(&bme->lock);
+    bool old = bme->forced;
+    bme->forced = forced;
+    ret = bme280_apply_config(bme);
+    if (ret)
+        bme->forced = old;
+    mutex_unlock(&bme->lock);
+    return ret < 0 ? ret : count;
+}
+
+static DEVICE_ATTR_RW(mode);
+
+//Register-code backed settings, shown and stored as their real values
+//(oversampling factor, IIR coefficient, standby in us)
+static ssize_t bme280_code_show(char *buf, const unsigned int *values, u8 code){
+    return sprintf(buf, "%u\n", values[code]);
+}
+
+static ssize_t bme280_code_store(struct bme280_dev *bme, u8 *field,
+                                 const unsigned int *values, size_t n, int min_code,
+                                 const char *buf, size_t count)
+{
+    unsigned int val;
+    int code;
+    int ret = kstrtouint(buf, 0, &val);
+
+    if (ret)
+        return ret;
+    code = bme280_value_to_code(values, n, val);
+    if (code < min_code)
+        return -EINVAL;
+    ret = bme280_update_config(bme, field, code);
+    return ret < 0 ? ret : count;
+}
+
+#define BME280_CODE_ATTR(_name, _field, _values, _min_code)                       \
+static ssize_t _name##_show(struct device *dev,                                  \
+                            struct device_attribute *attr, char *buf)           \
+{                                                                                \
+    struct bme280_dev *bme = dev_get_drvdata(dev);                               \
+    return bme280_code_show(buf, _values, READ_ONCE(bme->_field));               \
+}                                                                                \
+static ssize_t _name##_store(struct device *dev,                                 \
+                             struct device_attribute *attr,                     \
+                             const char *buf, size_t count)                     \
+{                                                                                \
+    struct bme280_dev *bme = dev_get_drvdata(dev);                               \
+    return bme280_code_store(bme, &bme->_field, _values, ARRAY_SIZE(_values),    \
+                             _min_code, buf, count);                             \
+}                                                                                \
+static DEVICE_ATTR_RW(_name)
+
+//Pressure and humidity compensation need t_fine, so temperature can't be skipped
+BME280_CODE_ATTR(osrs_t, osrs_t, bme280_osrs_values, 1);
+BME280_CODE_ATTR(osrs_p, osrs_p, bme280_osrs_values, 0);
+BME280_CODE_ATTR(osrs_h, osrs_h, bme280_osrs_values, 0);
+BME280_CODE_ATTR(iir_filter, filter, bme280_filter_values, 0);
+BME280_CODE_ATTR(t_sb_us, t_sb, bme280_t_sb_us_values, 0);
+
+//Datasheet max conversion time for the current oversampling
+static ssize_t measure_time_us_show(struct device *dev,
+                                    struct device_attribute *attr,
+                                    char *buf)
+{
+    struct bme280_dev *bme = dev_get_drvdata(dev);
+    unsigned int t;
+
+    mutex_lock(&bme->lock);
+    t = bme280_t_measure_us(bme);
+    mutex_unlock(&bme->lock);
+    return sprintf(buf, "%u\n", t);
+}
+
+static DEVICE_ATTR_RO(measure_time_us);
+
+//Highest rate at which every sample is a fresh conversion, in Hz with 3 decimals
+static ssize_t max_rate_hz_show(struct device *dev,
+                                struct device_attribute *attr,
+                                char *buf)
+{
+    struct bme280_dev *bme = dev_get_drvdata(dev);
+    unsigned int mhz;
+
+    mutex_lock(&bme->lock);
+    mhz = div_u64(1000000000ULL, bme280_min_period_us(bme));
+    mutex_unlock(&bme->lock);
+    return sprintf(buf, "%u.%03u\n", mhz / 1000, mhz % 1000);
+}
+
+static DEVICE_ATTR_RO(max_rate_hz);
+
+static ssize_t bus_bytes_per_sample_show(struct device *dev,
+                                         struct device_attribute *attr,
+                                         char *buf)
+{
+    struct bme280_dev *bme = dev_get_drvdata(dev);
+
+    return sprintf(buf, "%u\n", bme280_bus_bytes_per_sample(bme));
+}
+
+static DEVICE_ATTR_RO(bus_bytes_per_sample);
+
+static ssize_t batch_count_show(struct device *dev,
+                                struct device_attribute *attr,
+                                char *buf)
+{
+    struct bme280_dev *bme = dev_get_drvdata(dev);
+
+    return sprintf(buf, "%u\n", READ_ONCE(bme->batch_count));
+}
+
+//Samples per UDP datagram, 1..BME280_UDP_BATCH_MAX. Takes effect on the next sample.
+static ssize_t batch_count_store(struct device *dev,
+                                 struct device_attribute *attr,
+                                 const char *buf, size_t count)
+{
+    struct bme280_dev *bme = dev_get_drvdata(dev);
+    unsigned int val;
+    int ret = kstrtouint(buf, 0, &val);
+
+    if (ret)
+        return ret;
+    if (val < 1 || val > BME280_UDP_BATCH_MAX)
+        return -EINVAL;
+    WRITE_ONCE(bme->batch_count, val);
+    wake_up_interruptible(&bme->tx_wq);
+    return count;
+}
+
+static DEVICE_ATTR_RW(batch_count);
+
+static ssize_t batch_timeout_us_show(struct device *dev,
+                                     struct device_attribute *attr,
+                                     char *buf)
+{
+    struct bme280_dev *bme = dev_get_drvdata(dev);
+
+    return sprintf(buf, "%u\n", READ_ONCE(bme->batch_timeout_us));
+}
+
+//0 = send only when batch_count samples are queued
+static ssize_t batch_timeout_us_store(struct device *dev,
+                                      struct device_attribute *attr,
+                                      const char *buf, size_t count)
+{
+    struct bme280_dev *bme = dev_get_drvdata(dev);
+    unsigned int val;
+    int ret = kstrtouint(buf, 0, &val);
+
+    if (ret)
+        return ret;
+    WRITE_ONCE(bme->batch_timeout_us, val);
+    //the TX thread may be sleeping on the old timeout
+    wake_up_interruptible(&bme->tx_wq);
+    return count;
+}
+
+static DEVICE_ATTR_RW(batch_timeout_us);
+
+static ssize_t aggregate_window_show(struct device *dev,
+                                     struct device_attribute *attr,
+                                     char *buf)
+{
+    struct bme280_dev *bme = dev_get_drvdata(dev);
+
+    return sprintf(buf, "%u\n", READ_ONCE(bme->agg_window));
+}
+
+//Samples per summary record on UDP and netlink, 0 sends every sample. A window
+//in progress keeps going and completes at the new size.
+static ssize_t aggregate_window_store(struct device *dev,
+                                      struct device_attribute *attr,
+                                      const char *buf, size_t count)
+{
+    struct bme280_dev *bme = dev_get_drvdata(dev);
+    unsigned int val;
+    int ret = kstrtouint(buf, 0, &val);
+
+    if (ret)
+        return ret;
+    if (val > BME280_AGG_WINDOW_MAX)
+        return -EINVAL;
+    WRITE_ONCE(bme->agg_window, val);
+    return count;
+}
+
+static DEVICE_ATTR_RW(aggregate_window);
+
+//Samples (or summaries) the sampler could not queue because the TX thread fell behind
+static ssize_t tx_drops_show(struct device *dev,
+                             struct device_attribute *attr,
+                             char *buf)
+{
+    struct bme280_dev *bme = dev_get_drvdata(dev);
+
+    return sprintf(buf, "%lld\n", atomic64_read(&bme->tx_drops));
+}
+
+static DEVICE_ATTR_RO(tx_drops);
+
+//Samples lost in failed sends (socket buffer full, no route)
+static ssize_t tx_errors_show(struct device *dev,
+                              struct device_attribute *attr,
+                              char *buf)
+{
+    struct bme280_dev *bme = dev_get_drvdata(dev);
+
+    return sprintf(buf, "%lld\n", atomic64_read(&bme->tx_errors));
+}
+
+static DEVICE_ATTR_RO(tx_errors);
+
+//Created by the driver core once probe succeeds and removed before my_remove()
+static struct attribute *bme280_attrs[] = {
+    &dev_attr_read_sensor.attr,
+    &dev_attr_read_sensor_fresh.attr,
+    &dev_attr_probe_time_us.attr,
+    &dev_attr_sample_period_us.attr,
+    &dev_attr_overruns.attr,
+    &dev_attr_mode.attr,
+    &dev_attr_osrs_t.attr,
+    &dev_attr_osrs_p.attr,
+    &dev_attr_osrs_h.attr,
+    &dev_attr_iir_filter.attr,
+    &dev_attr_t_sb_us.attr,
+    &dev_attr_measure_time_us.attr,
+    &dev_attr_max_rate_hz.attr,
+    &dev_attr_bus_bytes_per_sample.attr,
+    &dev_attr_batch_count.attr,
+    &dev_attr_batch_timeout_us.attr,
+    &dev_attr_aggregate_window.attr,
+    &dev_attr_tx_drops.attr,
+    &dev_attr_tx_errors.attr,
+    NULL,
+};
+
+static const struct attribute_group bme280_group = {
+    .attrs = bme280_attrs,
+};
+
+static const struct attribute_group *bme280_groups[] = {
+    &bme280_group,
+    &bme280_sched_group,
+    &bme280_deadband_group,
+    &bme280_decim_group,
+    &bme280_filter_group,
+    NULL,
+};
+
 static int my_probe(struct i2c_client *client)
 {
-    int id = i2c_smbus_read_byte_data(client, 0xD0);
-    if (id < 0) {
-        pr_err("Chip ID read failed: %d\n", id);
-        return id;
+    u64 probe_start = ktime_get_ns();
+    struct bme280_dev *bme;
+    unsigned int id;
+
+    bme = devm_kzalloc(&client->dev, sizeof(*bme), GFP_KERNEL);
+    if (!bme)
+        return -ENOMEM;
+    bme->client = client;
+    bme->regmap = devm_regmap_init_i2c(client, &bme280_regmap_config);
+    if (IS_ERR(bme->regmap)) {
+        pr_err("regmap init failed: %ld\n", PTR_ERR(bme->regmap));
+        return PTR_ERR(bme->regmap);
     }
-    int ret = udp_init_socket();
+    int ret = regmap_read(bme->regmap, BME280_REG_CHIP_ID, &id);
+    if (ret) {
+        pr_err("Chip ID read failed: %d\n", ret);
+        return ret;
+    }
+
+    mutex_init(&bme->lock);
+    seqlock_init(&bme->latest_lock);
+    init_waitqueue_head(&bme->tx_wq);
+    INIT_KFIFO(bme->tx_fifo);
+    INIT_KFIFO(bme->summary_fifo);
+    atomic64_set(&bme->deadband.suppressed, 0);
+    atomic64_set(&bme->overruns, 0);
+    i2c_set_clientdata(client, bme);
+
+    ret = udp_init_socket(bme);
     if (ret)
         pr_warn("UDP init failed (%d). Will continue without UDP.\n", ret);
     pr_info("BME280 Chip ID: 0x%x\n", id);
@@ -328,26 +1225,106 @@ static int my_probe(struct i2c_client *client)
     struct my_data *data = (struct my_data *)i2c_get_match_data(client);
     if (!data)
         data = &a; // fallback
-    int init_result = bme280_init(client); 
-    msleep(50);
+
+    ret = bme280_wait_nvm_copy(bme);
+    if (ret) {
+        pr_err("BME280 NVM copy did not complete: %d\n", ret);
+        goto err_udp;
+    }
 
     printk(KERN_INFO "my_i2c_driver - %s data->i=%d\n", data->name, data->i);
 
-    read_calibration_data(client);
+    ret = read_calibration_data(bme);
+    if (ret) {
+        pr_err("Calibration read failed: %d\n", ret);
+        goto err_udp;
+    }
+
+    bme->osrs_t = 1;
+    bme->osrs_p = 1;
+    bme->osrs_h = 1;
+    bme->forced = forced_mode;
+    ret = bme280_init(bme);
+    if (ret) {
+        pr_err("BME280 init failed: %d\n", ret);
+        goto err_udp;
+    }
+
+    bme->period_us = max(period_us, bme280_min_period_us(bme));
+    bme->batch_count = clamp(udp_batch_count, 1U, (unsigned int)BME280_UDP_BATCH_MAX);
+    bme->batch_timeout_us = udp_batch_timeout_us;
+    bme280_filter_init(&bme->chan_filter);
+    bme280_decim_init(&bme->decim, decimate_factor);
+    bme->agg_window = min_t(unsigned int, aggregate_window, BME280_AGG_WINDOW_MAX);
+    bme->stats = bme280_stats_create(&client->dev);
+    if (IS_ERR(bme->stats)) {
+        pr_warn("Latency histograms unavailable (%ld). Will continue without them.\n",
+                PTR_ERR(bme->stats));
+        bme->stats = NULL;
+    } else {
+        bme280_decim_debugfs(&bme->decim, bme->stats->dir);
+    }
+    ret = bme280_iio_register(bme);
+    if (ret)
+        pr_warn("IIO registration failed (%d). Will continue without it.\n", ret);
+    bme->cdev = bme280_cdev_register(&client->dev, dev_name(&client->dev));
+    if (IS_ERR(bme->cdev)) {
+        pr_warn("/dev/bme280-%s registration failed (%ld). Will continue without it.\n",
+                dev_name(&client->dev), PTR_ERR(bme->cdev));
+        bme->cdev = NULL;
+    }
+    bme280_pipeline_attach(bme);
+    bme->tx_thread = kthread_run(tx_thread_fn, bme, "bme280-tx/%s", dev_name(&client->dev));
+    if (IS_ERR(bme->tx_thread)) {
+        pr_warn("TX thread start failed (%ld). Will continue without UDP and netlink.\n",
+                PTR_ERR(bme->tx_thread));
+        bme->tx_thread = NULL;
+    }
+    struct bme280_sched sched = {
+        .policy = SCHED_NORMAL,
+        .fifo_prio = sampler_fifo_prio,
+        .dl_runtime_us = sampler_dl_runtime_us,
+        .dl_period_us = sampler_dl_period_us,
+    };
+    ret = bme280_sched_policy_from_name(sampler_policy);
+    if (ret < 0)
+        pr_warn("%s: unknown sampler_policy \"%s\", staying on normal\n", dev_name(&client->dev), sampler_policy);
+    else
+        sched.policy = ret;
+    bme->bus = bme280_bus_get(client->adapter, &sched, sampler_cpus, spread_workers);
+    if (IS_ERR(bme->bus)) {
+        ret = PTR_ERR(bme->bus);
+        pr_err("Sampling worker start failed: %d\n", ret);
+        goto err_cdev;
+    }
+    bme280_bus_add(bme->bus, bme);
 
-    device_create_file(&client->dev, &dev_attr_read_sensor);
-    sensor_thread = kthread_run(sensor_thread_fn,
-                            client,
-                            "bme280_thread");
+    bme->probe_time_ns = ktime_get_ns() - probe_start;
+    pr_info("%s: probe took %llu us\n", dev_name(&client->dev), bme->probe_time_ns / 1000);
     printk("End of probe \n");
     return 0;
+
+err_cdev:
+    if (bme->tx_thread)
+        kthread_stop(bme->tx_thread);
+    bme280_pipeline_detach(bme);
+    bme280_cdev_unregister(bme->cdev);
+err_udp:
+    udp_close_socket(bme);
+    return ret;
 }
 static void my_remove(struct i2c_client *client){
-    if (sensor_thread)
-        kthread_stop(sensor_thread);
-    device_remove_file(&client->dev, &dev_attr_read_sensor);
-    udp_close_socket();
-    printk("Removing device \n");
+    struct bme280_dev *bme = i2c_get_clientdata(client);
+
+    bme280_bus_del(bme->bus, bme);
+    bme280_bus_put(bme->bus);
+    //after the sampler, so it flushes everything that was queued
+    if (bme->tx_thread)
+        kthread_stop(bme->tx_thread);
+    bme280_pipeline_detach(bme);
+    bme280_cdev_unregister(bme->cdev);
+    udp_close_socket(bme);
+    printk("Removing device %s\n", dev_name(&client->dev));
 }
 
 static const struct of_device_id my_of_match[] = {
@@ -362,7 +1339,40 @@ static struct i2c_driver my_driver= {
     .driver = {
         .name = "my-i2c-driver",
         .of_match_table = my_of_match,
+        .dev_groups = bme280_groups,
     }
 };
 
-module_i2c_driver(my_driver);
+static int __init bme280_module_init(void){
+    int ret;
+
+    bme280_stats_init();
+    ret = bme280_genl_init();
+    if (ret)
+        goto err_stats;
+    ret = bme280_pipeline_init();
+    if (ret)
+        goto err_genl;
+    ret = i2c_add_driver(&my_driver);
+    if (ret)
+        goto err_pipeline;
+    return 0;
+
+err_pipeline:
+    bme280_pipeline_exit();
+err_genl:
+    bme280_genl_exit();
+err_stats:
+    bme280_stats_exit();
+    return ret;
+}
+
+static void __exit bme280_module_exit(void){
+    i2c_del_driver(&my_driver);
+    bme280_pipeline_exit();
+    bme280_genl_exit();
+    bme280_stats_exit();
+}
+
+module_init(bme280_module_init);
+module_exit(bme280_module_exit);
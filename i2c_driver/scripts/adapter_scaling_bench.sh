@@ -0,0 +1,105 @@
+#!/bin/bash
+# Measures aggregate sample throughput across I2C adapters, with the per-adapter
+# sampling workers packed onto one CPU and then spread over their own CPUs.
+#
+# Every bound sensor is set to its fastest accepted sample_period_us (or
+# PERIOD_US), the histograms are reset, and after DURATION seconds the samples
+# taken are summed per adapter and over all adapters. The packed run pins every
+# worker to PACK_CPU through sched/cpus; the spread run restores the placement
+# the driver chose. Load the module with spread_workers=1 for that to bind each
+# worker to its own CPU; it is off by default.
+#
+# usage: adapter_scaling_bench.sh [duration_s] [devices...]
+#   duration_s  seconds per run (default 10)
+#   devices     i2c device names, e.g. 1-0076 3-0077 (default: every bme280)
+#
+# PERIOD_US=<us> overrides the sample period, PACK_CPU=<cpu> the CPU used for the
+# packed run (default 0). Run as root with debugfs mounted. i2c-stub only creates
+# one adapter, so this needs sensors on at least two real buses to show scaling.
+
+set -euo pipefail
+
+DURATION=${1:-10}
+shift $(( $# < 1 ? $# : 1 ))
+PACK_CPU=${PACK_CPU:-0}
+DEBUGFS=/sys/kernel/debug/bme280
+
+if [ $# -gt 0 ]; then
+    DEVS=("$@")
+else
+    DEVS=()
+    for d in "$DEBUGFS"/*/; do
+        [ -d "$d" ] && DEVS+=("$(basename "$d")")
+    done
+fi
+[ ${#DEVS[@]} -gt 0 ] || { echo "no bme280 devices found under $DEBUGFS" >&2; exit 1; }
+
+# one sensor per adapter is enough to move that adapter's worker
+declare -A FIRST ORIG_CPUS ORIG_PERIOD
+for dev in "${DEVS[@]}"; do
+    [ -d "/sys/bus/i2c/devices/$dev" ] || { echo "no such device: $dev" >&2; exit 1; }
+    bus=${dev%%-*}
+    [ -n "${FIRST[$bus]:-}" ] || FIRST[$bus]=$dev
+    ORIG_PERIOD[$dev]=$(cat "/sys/bus/i2c/devices/$dev/sample_period_us")
+done
+for bus in "${!FIRST[@]}"; do
+    ORIG_CPUS[$bus]=$(cat "/sys/bus/i2c/devices/${FIRST[$bus]}/sched/cpus")
+done
+
+restore() {
+    for bus in "${!FIRST[@]}"; do
+        echo "${ORIG_CPUS[$bus]}" > "/sys/bus/i2c/devices/${FIRST[$bus]}/sched/cpus" || true
+    done
+    for dev in "${DEVS[@]}"; do
+        echo "${ORIG_PERIOD[$dev]}" > "/sys/bus/i2c/devices/$dev/sample_period_us" || true
+    done
+}
+trap restore EXIT
+
+# fastest period the driver accepts: ceil(1e6 / max_rate_hz)
+fastest_period() {
+    local rate milli
+    rate=$(cat "/sys/bus/i2c/devices/$1/max_rate_hz")
+    milli=$(( ${rate%.*} * 1000 + 10#${rate#*.} ))
+    echo $(( (1000000000 + milli - 1) / milli ))
+}
+
+for dev in "${DEVS[@]}"; do
+    echo "${PERIOD_US:-$(fastest_period "$dev")}" > "/sys/bus/i2c/devices/$dev/sample_period_us"
+done
+
+# run <label>: prints one line per adapter and the total
+run() {
+    local label=$1 bus dev n total=0
+    declare -A per_bus=()
+
+    sleep 1
+    for dev in "${DEVS[@]}"; do
+        echo 1 > "$DEBUGFS/$dev/reset"
+    done
+    sleep "$DURATION"
+    for dev in "${DEVS[@]}"; do
+        n=$(awk '$1 == "count" { print $2 }' "$DEBUGFS/$dev/loop_exec")
+        per_bus[${dev%%-*}]=$(( ${per_bus[${dev%%-*}]:-0} + n ))
+        total=$(( total + n ))
+    done
+    for bus in $(printf '%s\n' "${!per_bus[@]}" | sort -n); do
+        printf '%-7s i2c-%-4s %6s %12d\n' "$label" "$bus" \
+               "$(ps -o psr= -p "$(pgrep -x "bme280/i2c-$bus" | head -1)" 2>/dev/null | tr -d ' ')" \
+               $(( per_bus[$bus] / DURATION ))
+    done
+    printf '%-7s %-8s %6s %12d\n' "$label" total - $(( total / DURATION ))
+}
+
+echo "${#DEVS[@]} sensors on ${#FIRST[@]} adapters, ${DURATION} s per run"
+printf '%-7s %-8s %6s %12s\n' run adapter cpu samples/s
+
+for bus in "${!FIRST[@]}"; do
+    echo "$PACK_CPU" > "/sys/bus/i2c/devices/${FIRST[$bus]}/sched/cpus"
+done
+run packed
+
+for bus in "${!FIRST[@]}"; do
+    echo "${ORIG_CPUS[$bus]}" > "/sys/bus/i2c/devices/${FIRST[$bus]}/sched/cpus"
+done
+run spread
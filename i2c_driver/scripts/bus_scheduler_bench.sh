@@ -0,0 +1,128 @@
+#!/bin/bash
+# Benchmarks the per-adapter sampling worker with simulated sensors on i2c-stub.
+#
+# Loads i2c-stub with up to 10 chips (the most it supports), fills each with a
+# BME280 chip id, datasheet-typical calibration and a fixed data block, then
+# for every sensor count binds that many devices to the driver and samples for
+# DURATION seconds at PERIOD_US. Per count it prints the aggregate sample rate,
+# overruns, the worst loop period p99 of any sensor, and the wakeup latency
+# (deadline to read) of the first and last sensor in a pass, which is how far
+# apart the sampling instants on the bus are.
+#
+# i2c-stub answers without real bus time, so this measures the scheduler's own
+# cost and how it packs transactions, not a physical bus.
+#
+# usage: bus_scheduler_bench.sh [duration_s] [sensor_counts...]
+#   duration_s     seconds per run (default 10)
+#   sensor_counts  numbers of sensors, 1..10 (default: 1 2 4 8 10)
+#
+# PERIOD_US=<us> sets every sensor's sample_period_us (default 10000),
+# MODE=forced runs them in forced mode. Needs root, i2c-tools, debugfs and the
+# bme280 module loaded; i2c-stub must not be loaded yet.
+
+set -euo pipefail
+
+DURATION=${1:-10}
+shift $(( $# < 1 ? $# : 1 ))
+COUNTS=${*:-1 2 4 8 10}
+PERIOD_US=${PERIOD_US:-10000}
+MODE=${MODE:-normal}
+ADDRS=(0x10 0x11 0x12 0x13 0x14 0x15 0x16 0x17 0x18 0x19)
+
+command -v i2cset >/dev/null || { echo "i2cset not found (install i2c-tools)" >&2; exit 1; }
+[ -d /sys/kernel/debug/bme280 ] || { echo "bme280 module not loaded or debugfs not mounted" >&2; exit 1; }
+
+modprobe i2c-stub chip_addr=$(IFS=,; echo "${ADDRS[*]}")
+BUS=
+for adapter in /sys/bus/i2c/devices/i2c-*; do
+    if grep -q "SMBus stub driver" "$adapter/name"; then
+        BUS=${adapter##*/i2c-}
+    fi
+done
+[ -n "$BUS" ] || { echo "i2c-stub adapter not found" >&2; exit 1; }
+
+unbind_all() {
+    for addr in "${ADDRS[@]}"; do
+        [ -d "/sys/bus/i2c/devices/$BUS-00${addr#0x}" ] &&
+            echo "$addr" > "/sys/bus/i2c/devices/i2c-$BUS/delete_device"
+    done
+    return 0
+}
+cleanup() {
+    unbind_all
+    rmmod i2c-stub 2>/dev/null || true
+}
+trap cleanup EXIT
+
+# 0x88..0xA1: dig_T1..dig_P9, reserved, dig_H1
+CALIB_TP=(0x70 0x6B 0x43 0x67 0x18 0xFC 0x7D 0x8E 0x43 0xD6 0xD0 0x0B 0x27 0x0B
+          0x8C 0x00 0xF9 0xFF 0x8C 0x3C 0xF8 0xC6 0x70 0x17 0x00 0x4B)
+# 0xE1..0xE7: dig_H2..dig_H6
+CALIB_H=(0x6A 0x01 0x00 0x13 0x29 0x03 0x1E)
+# 0xF7..0xFE: press, temp, hum
+DATA=(0x65 0x5A 0xC0 0x7E 0xED 0x00 0x6A 0x00)
+
+# fill <addr> <first_reg> <bytes...>
+fill() {
+    local addr=$1 reg=$2
+    shift 2
+    for byte in "$@"; do
+        i2cset -y "$BUS" "$addr" "$reg" "$byte"
+        reg=$(( reg + 1 ))
+    done
+}
+
+for addr in "${ADDRS[@]}"; do
+    fill "$addr" 0xD0 0x60
+    fill "$addr" 0x88 "${CALIB_TP[@]}"
+    fill "$addr" 0xE1 "${CALIB_H[@]}"
+    fill "$addr" 0xF7 "${DATA[@]}"
+done
+
+# field <device> <histogram> <key>
+field() {
+    awk -v k="$3" '$1 == k { v = $2 } END { print v + 0 }' "/sys/kernel/debug/bme280/$1/$2"
+}
+
+echo "i2c-stub on i2c-$BUS, period ${PERIOD_US} us, mode $MODE, ${DURATION} s per run"
+printf '%8s %10s %9s %14s %16s %16s %14s\n' \
+       sensors samples/s overruns period_p99_us wake_first_p50_us wake_last_p50_us wake_max_us
+
+for n in $COUNTS; do
+    [ "$n" -ge 1 ] && [ "$n" -le ${#ADDRS[@]} ] || { echo "skipping $n: 1..${#ADDRS[@]} sensors" >&2; continue; }
+    devs=()
+    for addr in "${ADDRS[@]:0:$n}"; do
+        echo "tyrunner_bme280 $addr" > "/sys/bus/i2c/devices/i2c-$BUS/new_device"
+        devs+=("$BUS-00${addr#0x}")
+    done
+    for dev in "${devs[@]}"; do
+        echo "$MODE" > "/sys/bus/i2c/devices/$dev/mode"
+        echo "$PERIOD_US" > "/sys/bus/i2c/devices/$dev/sample_period_us"
+    done
+    sleep 1
+
+    overruns_before=0
+    for dev in "${devs[@]}"; do
+        overruns_before=$(( overruns_before + $(cat "/sys/bus/i2c/devices/$dev/overruns") ))
+        echo 1 > "/sys/kernel/debug/bme280/$dev/reset"
+    done
+    sleep "$DURATION"
+
+    samples=0 overruns=0 period_p99=0 wake_max=0
+    wake_first=-1 wake_last=0
+    for dev in "${devs[@]}"; do
+        samples=$(( samples + $(field "$dev" loop_exec count) ))
+        overruns=$(( overruns + $(cat "/sys/bus/i2c/devices/$dev/overruns") ))
+        p99=$(field "$dev" loop_period p99_ns)
+        w50=$(field "$dev" wakeup p50_ns)
+        wmax=$(field "$dev" wakeup max_ns)
+        [ "$p99" -gt "$period_p99" ] && period_p99=$p99
+        [ "$wmax" -gt "$wake_max" ] && wake_max=$wmax
+        { [ "$wake_first" -lt 0 ] || [ "$w50" -lt "$wake_first" ]; } && wake_first=$w50
+        [ "$w50" -gt "$wake_last" ] && wake_last=$w50
+    done
+    printf '%8d %10d %9d %14d %16d %16d %14d\n' "$n" $(( samples / DURATION )) \
+           $(( overruns - overruns_before )) $(( period_p99 / 1000 )) \
+           $(( wake_first / 1000 )) $(( wake_last / 1000 )) $(( wake_max / 1000 ))
+    unbind_all
+done
@@ -0,0 +1,74 @@
+#!/bin/bash
+# CPU cost of the in-kernel decimation filter per output sample.
+#
+# For each configuration the sensor's decimate/ settings are changed and
+# debugfs bme280/<device>/decimate_bench is read, which runs a private copy of
+# the filter over synthetic input for 10000 outputs. The sampler keeps running
+# meanwhile (its own filter restarts on every change); the original settings
+# are restored at the end.
+#
+# usage: decimator_bench.sh <device> [factors...]
+#   device   i2c device name, e.g. 1-0076
+#   factors  decimation factors to sweep (default: 4 16 64 256)
+#
+# CIC is run at orders 1..4. FIR is run with boxcar taps of 8, 16, 32 and 64
+# (the cost depends only on the tap count). Needs root and debugfs mounted.
+
+set -euo pipefail
+
+DEV=${1:?usage: decimator_bench.sh <device> [factors...]}
+shift
+FACTORS=${*:-4 16 64 256}
+SYSFS=/sys/bus/i2c/devices/$DEV/decimate
+BENCH=/sys/kernel/debug/bme280/$DEV/decimate_bench
+
+[ -d "$SYSFS" ] || { echo "no such device: $DEV" >&2; exit 1; }
+[ -r "$BENCH" ] || { echo "$BENCH not found (debugfs mounted?)" >&2; exit 1; }
+
+ORIG_FILTER=$(cat "$SYSFS/filter")
+ORIG_FACTOR=$(cat "$SYSFS/factor")
+ORIG_ORDER=$(cat "$SYSFS/cic_order")
+ORIG_TAPS=$(cat "$SYSFS/taps")
+restore() {
+    [ -n "$ORIG_TAPS" ] && echo "$ORIG_TAPS" > "$SYSFS/taps"
+    echo "$ORIG_ORDER" > "$SYSFS/cic_order"
+    echo "$ORIG_FACTOR" > "$SYSFS/factor"
+    echo "$ORIG_FILTER" > "$SYSFS/filter"
+}
+trap restore EXIT
+
+# boxcar <n>: n Q15 taps summing to 32768
+boxcar() {
+    local n=$1 i taps=()
+    for (( i = 0; i < n; i++ )); do
+        taps+=($(( 32768 / n + (i < 32768 % n ? 1 : 0) )))
+    done
+    echo "${taps[*]}"
+}
+
+field() {
+    awk -v k="$2" '$1 == k { print $2 }' <<<"$1"
+}
+
+# run <label>: one line from the current config
+run() {
+    local out
+    out=$(cat "$BENCH")
+    printf '%-8s %6d %14d %13d\n' "$1" "$(field "$out" factor)" \
+           "$(field "$out" ns_per_output)" "$(field "$out" ns_per_input)"
+}
+
+printf '%-8s %6s %14s %13s\n' filter factor ns_per_output ns_per_input
+for factor in $FACTORS; do
+    echo "$factor" > "$SYSFS/factor"
+    echo cic > "$SYSFS/filter"
+    for order in 1 2 3 4; do
+        echo "$order" > "$SYSFS/cic_order"
+        run "cic$order"
+    done
+    for ntaps in 8 16 32 64; do
+        boxcar "$ntaps" > "$SYSFS/taps"
+        echo fir > "$SYSFS/filter"
+        run "fir$ntaps"
+    done
+done
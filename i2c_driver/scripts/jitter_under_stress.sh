@@ -0,0 +1,91 @@
+#!/bin/bash
+# Measures sampler loop period jitter per scheduling policy, idle and under load.
+#
+# For every policy it resets the debugfs histograms, optionally starts a CPU/IO
+# load, samples for DURATION seconds and prints the loop_period percentiles. The
+# difference between p50 and p99.9/max is the jitter the policy lets through; the
+# wakeup columns show how much of it is scheduling rather than bus time.
+#
+# usage: jitter_under_stress.sh <device> [duration_s] [policies...]
+#   device      i2c device name, e.g. 1-0076
+#   duration_s  seconds per run (default 30)
+#   policies    any of normal fifo deadline (default: all three)
+#
+# Load is stress-ng if installed, otherwise one busy loop per CPU. Set
+# STRESS="..." to use another load command, CPUS=<cpulist> to pin the sampler
+# first (not accepted together with deadline). Run as root with debugfs mounted.
+
+set -euo pipefail
+
+DEV=${1:?usage: $0 <device> [duration_s] [policies...]}
+DURATION=${2:-30}
+shift $(( $# < 2 ? $# : 2 ))
+POLICIES=${*:-normal fifo deadline}
+
+SYSFS=/sys/bus/i2c/devices/$DEV
+DEBUGFS=/sys/kernel/debug/bme280/$DEV
+NCPU=$(nproc)
+
+[ -d "$SYSFS" ] || { echo "no such device: $SYSFS" >&2; exit 1; }
+[ -d "$DEBUGFS" ] || { echo "no histograms at $DEBUGFS (debugfs mounted?)" >&2; exit 1; }
+
+LOAD_PIDS=()
+
+start_load() {
+    if [ -n "${STRESS:-}" ]; then
+        $STRESS &
+        LOAD_PIDS+=($!)
+    elif command -v stress-ng >/dev/null; then
+        stress-ng --cpu "$NCPU" --io 2 --vm 1 --vm-bytes 128M --timeout "${DURATION}s" >/dev/null 2>&1 &
+        LOAD_PIDS+=($!)
+    else
+        for _ in $(seq "$NCPU"); do
+            sh -c 'while :; do :; done' &
+            LOAD_PIDS+=($!)
+        done
+    fi
+}
+
+stop_load() {
+    [ ${#LOAD_PIDS[@]} -eq 0 ] && return
+    kill "${LOAD_PIDS[@]}" 2>/dev/null || true
+    wait "${LOAD_PIDS[@]}" 2>/dev/null || true
+    LOAD_PIDS=()
+}
+trap stop_load EXIT
+
+# field <histogram> <key>
+field() {
+    awk -v k="$2" '$1 == k { v = $2 } END { print v + 0 }' "$DEBUGFS/$1"
+}
+
+orig_policy=$(cat "$SYSFS/sched/policy")
+orig_cpus=$(cat "$SYSFS/sched/cpus")
+[ -n "${CPUS:-}" ] && echo "$CPUS" > "$SYSFS/sched/cpus"
+period_us=$(cat "$SYSFS/sample_period_us")
+echo "device $DEV, sample period ${period_us} us, ${DURATION} s per run, $NCPU CPUs"
+printf '%-9s %-6s %8s %10s %10s %10s %10s %10s %12s %12s\n' \
+       policy load count p50_us p99_us p99.9_us max_us overruns wake_p99.9_us wake_max_us
+
+for policy in $POLICIES; do
+    if ! echo "$policy" > "$SYSFS/sched/policy"; then
+        echo "$policy: rejected by the kernel, skipping" >&2
+        continue
+    fi
+    for load in idle stress; do
+        overruns_before=$(cat "$SYSFS/overruns")
+        echo 1 > "$DEBUGFS/reset"
+        [ "$load" = stress ] && start_load
+        sleep "$DURATION"
+        stop_load
+        printf '%-9s %-6s %8s %10d %10d %10d %10d %10d %12d %12d\n' "$policy" "$load" \
+               "$(field loop_period count)" \
+               $(( $(field loop_period p50_ns) / 1000 )) $(( $(field loop_period p99_ns) / 1000 )) \
+               $(( $(field loop_period p99.9_ns) / 1000 )) $(( $(field loop_period max_ns) / 1000 )) \
+               $(( $(cat "$SYSFS/overruns") - overruns_before )) \
+               $(( $(field wakeup p99.9_ns) / 1000 )) $(( $(field wakeup max_ns) / 1000 ))
+    done
+done
+
+echo "$orig_policy" > "$SYSFS/sched/policy"
+echo "$orig_cpus" > "$SYSFS/sched/cpus"
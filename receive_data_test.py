@@ -1,7 +1,13 @@
 import socket
 import struct
 
-fmt = ">Q i I I H"
+fmt = "=Q i I I H"  # host byte order, as in bme280_uapi.h
+rec_size = struct.calcsize(fmt)
+
+# aggregation mode: one window summary per datagram, in the sender's byte order
+SUMMARY_MAGIC = 0x4D555342
+sum_fmt = "=I I Q Q iiiI iiiI iiiI"
+sum_size = struct.calcsize(sum_fmt)
 
 sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
 sock.bind(("0.0.0.0", 5005))
@@ -9,16 +15,28 @@ sock.bind(("0.0.0.0", 5005))
 print("Listening on UDP 5005...")
 
 while True:
-    data, addr = sock.recvfrom(1024)
+    # the driver may batch several records into one datagram
+    data, addr = sock.recvfrom(2048)
+
+    if len(data) == sum_size and struct.unpack_from("=I", data)[0] == SUMMARY_MAGIC:
+        f = struct.unpack(sum_fmt, data)
+        print("Window: %d samples, %d..%d ns" % (f[1], f[2], f[3]))
+        for name, scale, c in (("Temp (C)", 100.0, f[4:8]), ("Pressure (Pa)", 256.0, f[8:12]),
+                               ("Humidity (%)", 1024.0, f[12:16])):
+            print("%s: min %.2f max %.2f mean %.2f stddev %.2f" %
+                  (name, c[0] / scale, c[1] / scale, c[2] / scale, c[3] / scale))
+        print("------")
+        continue
 
-    if len(data) != struct.calcsize(fmt):
+    if len(data) == 0 or len(data) % rec_size:
         print("Unexpected size:", len(data))
         continue
 
-    ts, temp, hum, press, crc = struct.unpack(fmt, data)
+    for off in range(0, len(data), rec_size):
+        ts, temp, hum, press, crc = struct.unpack_from(fmt, data, off)
 
-    print("Timestamp:", ts)
-    print("Temp (C):", temp / 100.0)
-    print("Humidity:", hum)
-    print("Pressure:", press)
-    print("------")
\ No newline at end of file
+        print("Timestamp:", ts)
+        print("Temp (C):", temp / 100.0)
+        print("Humidity:", hum)
+        print("Pressure:", press)
+        print("------")
\ No newline at end of file
@@ -0,0 +1,97 @@
+import socket
+import struct
+
+# Joins the bme280 generic netlink "samples" group and prints every record.
+# Records are struct bme280_sensor_packet in host byte order.
+fmt = "=Q i I I H"
+rec_size = struct.calcsize(fmt)
+
+NETLINK_GENERIC = 16
+SOL_NETLINK = 270
+NETLINK_ADD_MEMBERSHIP = 1
+GENL_ID_CTRL = 0x10
+NLM_F_REQUEST = 0x1
+CTRL_CMD_GETFAMILY = 3
+CTRL_ATTR_FAMILY_ID = 1
+CTRL_ATTR_FAMILY_NAME = 2
+CTRL_ATTR_MCAST_GROUPS = 7
+CTRL_ATTR_MCAST_GRP_NAME = 1
+CTRL_ATTR_MCAST_GRP_ID = 2
+
+BME280_GENL_ATTR_BUS = 1
+BME280_GENL_ATTR_ADDR = 2
+BME280_GENL_ATTR_SAMPLES = 3
+BME280_GENL_ATTR_SUMMARY = 4
+sum_fmt = "=I I Q Q iiiI iiiI iiiI"
+
+
+def parse_attrs(data):
+    attrs = {}
+    off = 0
+    while off + 4 <= len(data):
+        length, kind = struct.unpack_from("=HH", data, off)
+        if length < 4:
+            break
+        attrs[kind & 0x3FFF] = data[off + 4:off + length]
+        off += (length + 3) & ~3
+    return attrs
+
+
+def resolve(sock, family, group):
+    name = family.encode() + b"\0"
+    attr = struct.pack("=HH", 4 + len(name), CTRL_ATTR_FAMILY_NAME) + name
+    attr += b"\0" * (-len(attr) % 4)
+    payload = struct.pack("=BBH", CTRL_CMD_GETFAMILY, 1, 0) + attr
+    sock.send(struct.pack("=IHHII", 16 + len(payload), GENL_ID_CTRL, NLM_F_REQUEST, 1, 0) + payload)
+
+    reply = sock.recv(65536)
+    msg_type = struct.unpack_from("=H", reply, 4)[0]
+    if msg_type != GENL_ID_CTRL:
+        raise SystemExit("bme280 netlink family not found (module loaded?)")
+    attrs = parse_attrs(reply[20:])
+    family_id = struct.unpack("=H", attrs[CTRL_ATTR_FAMILY_ID][:2])[0]
+    for grp in parse_attrs(attrs[CTRL_ATTR_MCAST_GROUPS]).values():
+        g = parse_attrs(grp)
+        if g[CTRL_ATTR_MCAST_GRP_NAME].rstrip(b"\0").decode() == group:
+            return family_id, struct.unpack("=I", g[CTRL_ATTR_MCAST_GRP_ID])[0]
+    raise SystemExit("group %s not found" % group)
+
+
+sock = socket.socket(socket.AF_NETLINK, socket.SOCK_RAW, NETLINK_GENERIC)
+sock.bind((0, 0))
+family_id, group_id = resolve(sock, "bme280", "samples")
+sock.setsockopt(SOL_NETLINK, NETLINK_ADD_MEMBERSHIP, group_id)
+
+print("Listening on generic netlink bme280/samples...")
+
+while True:
+    data = sock.recv(65536)
+    off = 0
+    while off + 16 <= len(data):
+        length, msg_type = struct.unpack_from("=IH", data, off)
+        if length < 16:
+            break
+        if msg_type == family_id:
+            attrs = parse_attrs(data[off + 20:off + length])
+            bus = struct.unpack("=I", attrs[BME280_GENL_ATTR_BUS])[0]
+            addr = struct.unpack("=H", attrs[BME280_GENL_ATTR_ADDR])[0]
+            if BME280_GENL_ATTR_SUMMARY in attrs:
+                f = struct.unpack(sum_fmt, attrs[BME280_GENL_ATTR_SUMMARY])
+                print("Sensor: %d-%04x window of %d samples" % (bus, addr, f[1]))
+                print("Temp (C): min %.2f max %.2f mean %.2f stddev %.2f" % tuple(v / 100.0 for v in f[4:8]))
+                print("Pressure (Pa): min %.2f max %.2f mean %.2f stddev %.2f" % tuple(v / 256.0 for v in f[8:12]))
+                print("Humidity (%%): min %.2f max %.2f mean %.2f stddev %.2f" % tuple(v / 1024.0 for v in f[12:16]))
+                print("------")
+                off += (length + 3) & ~3
+                continue
+            samples = attrs[BME280_GENL_ATTR_SAMPLES]
+            for rec in range(0, len(samples) - rec_size + 1, rec_size):
+                ts, temp, hum, press, crc = struct.unpack_from(fmt, samples, rec)
+
+                print("Sensor: %d-%04x" % (bus, addr))
+                print("Timestamp:", ts)
+                print("Temp (C):", temp / 100.0)
+                print("Humidity:", hum)
+                print("Pressure:", press)
+                print("------")
+        off += (length + 3) & ~3